@@ -0,0 +1,2135 @@
+#include "libsflash.h"
+
+#include <stdlib.h>
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+struct CardT
+{
+  uint64_t iQuestion;
+  uint64_t iAnswer;
+  uint64_t iLine;
+  uint32_t iQuestionLen;
+  uint32_t iAnswerLen;
+};
+
+struct sflash_deck
+{
+  char * szText;
+  size_t iLen;
+  struct CardT * pCards;
+  size_t iCards;
+  size_t iCapacity;
+};
+
+struct sflash_reader
+{
+  FILE * file; /* not ours */
+  const struct sflash_dialect * dialect;
+  char * szBuf;
+  size_t iCapacity;
+  size_t iLen;
+  size_t iPos;       /* next line to look at */
+  uint64_t iBase;    /* file offset of szBuf[0] */
+  uint64_t iLine;    /* of iPos, 1-based, 0 when unknown */
+  size_t iReadAhead; /* doubles while reading on, up to READER_CHUNK */
+  int at_end;
+  int resync;        /* answers before the next question are skipped */
+};
+
+struct sflash_sequence
+{
+  size_t iItems;
+  size_t iWords;     /* 64-bit words per mask */
+  size_t iIds;       /* distinct items */
+  size_t iSlots;     /* hash table size, a power of two */
+  uint32_t * pSlots; /* id + 1, 0 when empty */
+  sflash_span * pKeys; /* per id, into szPool */
+  uint32_t * pCounts;  /* per id, occurrences in the sequence */
+  uint64_t * pMasks;   /* per id, iWords position bits */
+  char * szPool;
+};
+
+/*
+  What sets a dialect apart. The kernels that depend on it take
+  one as a constant and are always inlined, so each dialect gets
+  its own copy with its characters as immediates: no dialect
+  branches inside a loop, and any dialect scans as fast as the
+  default one. The copies are stamped out by SFLASH_DIALECTS.
+*/
+struct MarkersT
+{
+  char szQuestion[3]; /* one or two chars */
+  char szAnswer[3];
+  char cSeparator; /* between list and sequence items */
+  int trim; /* blanks after the marker are not part of the text */
+};
+
+#define SPECIALIZED static inline __attribute__((always_inline))
+
+struct sflash_dialect
+{
+  const char * szName;
+  const struct MarkersT * markers;
+  sflash_line (*line_kind)(const char *, size_t, size_t *);
+  size_t (*split)(sflash_kind, const char *, size_t, char *,
+    sflash_span *, size_t, int);
+  sflash_deck * (*index_cards)(sflash_deck *, sflash_error *);
+  size_t (*index_questions)(const char *, size_t, uint64_t,
+    sflash_offsets *, int *);
+  sflash_line (*next_line)(const char *, size_t, size_t *, uint64_t *,
+    size_t *, size_t *, size_t *);
+};
+
+unsigned sflash_abi_version(void)
+{
+  return SFLASH_ABI_VERSION;
+}
+
+static void set_error
+(
+  sflash_error * err,
+  sflash_status status,
+  uint64_t iLine,
+  uint32_t iColumn,
+  const char * szMessage
+)
+{
+  if(!err)
+    return;
+  err->status = status;
+  err->line = iLine;
+  err->column = iColumn;
+  strncpy(err->message, szMessage, sizeof(err->message) - 1);
+  err->message[sizeof(err->message) - 1] = 0;
+}
+
+static uint64_t hash_span
+(
+  const char * p,
+  size_t iLen
+)
+{
+  /* FNV-1a */
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for(size_t i = 0; i < iLen; ++i)
+  {
+    h ^= (unsigned char) p[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static int span_eq
+(
+  const char * a,
+  size_t iA,
+  const char * b,
+  size_t iB
+)
+{
+  return iA == iB && !memcmp(a, b, iA);
+}
+
+/*
+  Scanning kernels: 64 bytes per step, AVX2 or SSE2
+  compares when the compiler targets them
+*/
+
+static uint64_t byte_mask
+(
+  const char * p,
+  char c
+)
+/*
+  Bit i set when p[i] == c
+*/
+{
+#if defined(__AVX2__)
+  __m256i needle = _mm256_set1_epi8(c);
+  uint32_t lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+    _mm256_loadu_si256((const __m256i *) p), needle));
+  uint32_t hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+    _mm256_loadu_si256((const __m256i *) (p + 32)), needle));
+  return (uint64_t) lo | ((uint64_t) hi << 32);
+#elif defined(__SSE2__)
+  __m128i needle = _mm_set1_epi8(c);
+  uint64_t ret = 0;
+  for(int i = 0; i < 4; ++i)
+  {
+    uint32_t m = _mm_movemask_epi8(_mm_cmpeq_epi8(
+      _mm_loadu_si128((const __m128i *) (p + 16 * i)), needle));
+    ret |= (uint64_t) m << (16 * i);
+  }
+  return ret;
+#else
+  uint64_t ret = 0;
+  for(int i = 0; i < 64; ++i)
+    ret |= (uint64_t) (p[i] == c) << i;
+  return ret;
+#endif
+}
+
+SPECIALIZED uint64_t line_mask
+(
+  const struct MarkersT * m,
+  const char * p
+)
+/*
+  Bit i set when p[i] is '\n' or starts a card marker
+*/
+{
+#if defined(__AVX2__)
+  uint64_t ret = 0;
+  for(int half = 0; half < 2; ++half)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (p + 32 * half));
+    __m256i hits = _mm256_or_si256(
+      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(m->szQuestion[0])),
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(m->szAnswer[0]))));
+    ret |= (uint64_t) (uint32_t) _mm256_movemask_epi8(hits) << (32 * half);
+  }
+  return ret;
+#elif defined(__SSE2__)
+  uint64_t ret = 0;
+  for(int i = 0; i < 4; ++i)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *) (p + 16 * i));
+    __m128i hits = _mm_or_si128(
+      _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(m->szQuestion[0])),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8(m->szAnswer[0]))));
+    ret |= (uint64_t) (uint32_t) _mm_movemask_epi8(hits) << (16 * i);
+  }
+  return ret;
+#else
+  uint64_t ret = 0;
+  for(int i = 0; i < 64; ++i)
+    ret |= (uint64_t) (p[i] == '\n' || p[i] == m->szQuestion[0]
+      || p[i] == m->szAnswer[0]) << i;
+  return ret;
+#endif
+}
+
+uint64_t sflash_count_byte
+(
+  const char * src,
+  size_t len,
+  char c
+)
+{
+  uint64_t ret = 0;
+  size_t i = 0;
+  for(; i + 64 <= len; i += 64)
+    ret += __builtin_popcountll(byte_mask(src + i, c));
+  for(; i < len; ++i)
+    ret += src[i] == c;
+  return ret;
+}
+
+size_t sflash_find_nth_byte
+(
+  const char * src,
+  size_t len,
+  char c,
+  uint64_t n
+)
+{
+  if(!n)
+    return len;
+  size_t i = 0;
+  for(; i + 64 <= len; i += 64)
+  {
+    uint64_t mask = byte_mask(src + i, c);
+    uint64_t iHere = __builtin_popcountll(mask);
+    if(iHere < n)
+    {
+      n -= iHere;
+      continue;
+    }
+    while(--n)
+      mask &= mask - 1;
+    return i + __builtin_ctzll(mask);
+  }
+  for(; i < len; ++i)
+  {
+    if(src[i] == c && !--n)
+      return i;
+  }
+  return len;
+}
+
+/* Lines and answers */
+
+SPECIALIZED size_t marker_at
+(
+  const char * marker,
+  const char * line,
+  size_t len
+)
+/*
+  Length of `marker` when `line` starts with it, else 0
+*/
+{
+  if(!len || line[0] != marker[0])
+    return 0;
+  if(!marker[1])
+    return 1;
+  return len > 1 && line[1] == marker[1] ? 2 : 0;
+}
+
+SPECIALIZED sflash_line line_kind
+(
+  const struct MarkersT * m,
+  const char * line,
+  size_t len,
+  size_t * text
+)
+{
+  size_t i = 0;
+  size_t iMarker = 0;
+  while(i < len && (line[i] == ' ' || line[i] == '\t'))
+    ++i;
+  *text = 0;
+  sflash_line kind = SFLASH_LINE_OTHER;
+  if((iMarker = marker_at(m->szQuestion, line + i, len - i)))
+    kind = SFLASH_LINE_QUESTION;
+  else if((iMarker = marker_at(m->szAnswer, line + i, len - i)))
+    kind = SFLASH_LINE_ANSWER;
+  else
+    return SFLASH_LINE_OTHER;
+  i += iMarker;
+  while(m->trim && i < len && (line[i] == ' ' || line[i] == '\t'))
+    ++i;
+  *text = i;
+  return kind;
+}
+
+sflash_kind sflash_answer_kind
+(
+  const char * answer,
+  size_t len
+)
+{
+  for(size_t i = 0; i < len; ++i)
+  {
+    switch(answer[i])
+    {
+      case ' ':
+        break;
+      case '{':
+        return SFLASH_LIST;
+      case '[':
+        return SFLASH_SEQUENCE;
+      case '\n': case '\r':
+        return SFLASH_EMPTY;
+      default:
+        return SFLASH_TOKENS;
+    }
+  }
+  return SFLASH_EMPTY;
+}
+
+int sflash_escapable
+(
+  char c
+)
+{
+  switch(c)
+  {
+    case '-': case '+': case '{': case '}': case '[': case ']':
+    case ',': case ';': case '\\':
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+size_t sflash_unescape
+(
+  char * dst,
+  const char * src,
+  size_t len
+)
+{
+  char * pdst = dst;
+  for(size_t i = 0; i < len; ++i)
+  {
+    if(src[i] == '\\' && i + 1 < len && sflash_escapable(src[i + 1]))
+      ++i;
+    *(pdst++) = src[i];
+  }
+  return pdst - dst;
+}
+
+static size_t add_item
+(
+  sflash_span * items,
+  size_t max_items,
+  size_t iItems,
+  const char * text,
+  size_t len
+)
+{
+  if(iItems < max_items)
+  {
+    items[iItems].text = text;
+    items[iItems].len = len;
+  }
+  return iItems + 1;
+}
+
+SPECIALIZED size_t split
+(
+  const struct MarkersT * m,
+  sflash_kind kind,
+  const char * src,
+  size_t len,
+  char * buf,
+  sflash_span * items,
+  size_t max_items,
+  int escapes
+)
+/*
+  SFLASH_TOKENS: words split on every ' ', up to the line end
+  SFLASH_LIST: "{a, b}", blanks before an item skipped
+  SFLASH_SEQUENCE: "[a, b]", items trimmed, empty ones dropped
+*/
+{
+  size_t iItems = 0;
+  char * pItem = buf;
+  char * pbuf = buf;
+  int in_item = 0;
+
+  for(size_t i = 0; i < len; ++i)
+  {
+    char c = src[i];
+    int literal = 0;
+    if(escapes && c == '\\' && i + 1 < len && sflash_escapable(src[i + 1]))
+    {
+      c = src[++i];
+      literal = 1;
+    }
+
+    switch(kind)
+    {
+      case SFLASH_LIST:
+      {
+        if(literal)
+        {
+          in_item = 1;
+          *(pbuf++) = c;
+        }
+        else if(c == '{')
+          ;
+        else if(c == ' ')
+        {
+          if(in_item)
+            *(pbuf++) = c;
+        }
+        else if(c == m->cSeparator || c == '}')
+        {
+          iItems = add_item(items, max_items, iItems, pItem, pbuf - pItem);
+          pItem = pbuf;
+          in_item = 0;
+          if(c == '}')
+            return iItems;
+        }
+        else
+        {
+          in_item = 1;
+          *(pbuf++) = c;
+        }
+        break;
+      }
+      case SFLASH_SEQUENCE:
+      {
+        if(literal)
+          *(pbuf++) = c;
+        else if(c == '[')
+          ;
+        else if(c == ' ')
+        {
+          if(pbuf != pItem)
+            *(pbuf++) = c;
+        }
+        else if(c == m->cSeparator || c == ']' || c == '\n')
+        {
+          while(pbuf != pItem && pbuf[-1] == ' ')
+            --pbuf;
+          if(pbuf != pItem)
+            iItems = add_item(items, max_items, iItems, pItem, pbuf - pItem);
+          pItem = pbuf;
+          if(c != m->cSeparator)
+            return iItems;
+        }
+        else
+          *(pbuf++) = c;
+        break;
+      }
+      default:
+      {
+        if(!literal && c == ' ')
+        {
+          iItems = add_item(items, max_items, iItems, pItem, pbuf - pItem);
+          pItem = pbuf;
+        }
+        else if(!literal && c == '\n')
+          return add_item(items, max_items, iItems, pItem, pbuf - pItem);
+        else
+          *(pbuf++) = c;
+        break;
+      }
+    }
+  }
+
+  switch(kind)
+  {
+    case SFLASH_LIST:
+      break;
+    case SFLASH_SEQUENCE:
+    {
+      while(pbuf != pItem && pbuf[-1] == ' ')
+        --pbuf;
+      if(pbuf != pItem)
+        iItems = add_item(items, max_items, iItems, pItem, pbuf - pItem);
+      break;
+    }
+    default:
+      iItems = add_item(items, max_items, iItems, pItem, pbuf - pItem);
+      break;
+  }
+  return iItems;
+}
+
+/* Decks */
+
+static int add_card
+(
+  sflash_deck * deck,
+  const struct CardT * card
+)
+{
+  if(deck->iCards == deck->iCapacity)
+  {
+    size_t iCapacity = deck->iCapacity ? deck->iCapacity * 2 : 1024;
+    struct CardT * pCards = realloc(deck->pCards, iCapacity * sizeof(struct CardT));
+    if(!pCards)
+      return 0;
+    deck->pCards = pCards;
+    deck->iCapacity = iCapacity;
+  }
+  deck->pCards[deck->iCards++] = *card;
+  return 1;
+}
+
+SPECIALIZED sflash_deck * index_cards
+(
+  const struct MarkersT * m,
+  sflash_deck * deck,
+  sflash_error * err
+)
+/*
+  Finds every card from a mask of newlines and marker starts:
+  only a line with a masked char is looked at, and only up
+  to its marker. Text between masked chars is never read.
+*/
+{
+  const char * szText = deck->szText;
+  size_t iLen = deck->iLen;
+  size_t iLineStart = 0;
+  size_t iDelim = 0;
+  int have_delim = 0;
+  int have_question = 0;
+  uint64_t iLine = 1;
+  struct CardT card;
+  char tail[64];
+
+  for(size_t iBlock = 0; iBlock < iLen; iBlock += 64)
+  {
+    uint64_t mask;
+    if(iLen - iBlock >= 64)
+      mask = line_mask(m, szText + iBlock);
+    else
+    {
+      memset(tail, 0, sizeof(tail));
+      memcpy(tail, szText + iBlock, iLen - iBlock);
+      mask = line_mask(m, tail);
+    }
+
+    for(; mask; mask &= mask - 1)
+    {
+      size_t iPos = iBlock + __builtin_ctzll(mask);
+      if(szText[iPos] != '\n')
+      {
+        if(!have_delim)
+        {
+          iDelim = iPos;
+          have_delim = 1;
+        }
+        continue;
+      }
+
+      size_t iLineEnd = iPos;
+      if(iLineEnd > iLineStart && szText[iLineEnd - 1] == '\r')
+        --iLineEnd;
+      if(have_delim && iDelim < iLineEnd)
+      {
+        size_t iText = 0;
+        sflash_line kind = line_kind(m, szText + iLineStart,
+          iLineEnd - iLineStart, &iText);
+        if(kind == SFLASH_LINE_QUESTION)
+        {
+          if(have_question)
+          {
+            set_error(err, SFLASH_ERR_SYNTAX, card.iLine, 1,
+              "unmatched question/answer pair: question has no answer");
+            return NULL;
+          }
+          card.iQuestion = iLineStart + iText;
+          card.iQuestionLen = iLineEnd - card.iQuestion;
+          card.iLine = iLine;
+          have_question = 1;
+        }
+        else if(kind == SFLASH_LINE_ANSWER)
+        {
+          if(!have_question)
+          {
+            set_error(err, SFLASH_ERR_SYNTAX, iLine, iDelim - iLineStart + 1,
+              "unmatched question/answer pair: answer has no question");
+            return NULL;
+          }
+          card.iAnswer = iLineStart + iText;
+          card.iAnswerLen = iLineEnd - card.iAnswer;
+          if(!add_card(deck, &card))
+          {
+            set_error(err, SFLASH_ERR_NOMEM, 0, 0, "out of memory");
+            return NULL;
+          }
+          have_question = 0;
+        }
+      }
+      iLineStart = iPos + 1;
+      have_delim = 0;
+      ++iLine;
+    }
+  }
+
+  if(have_question)
+  {
+    set_error(err, SFLASH_ERR_SYNTAX, card.iLine, 1,
+      "unmatched question/answer pair: question has no answer");
+    return NULL;
+  }
+  set_error(err, SFLASH_OK, 0, 0, "");
+  return deck;
+}
+
+SPECIALIZED sflash_line next_line
+(
+  const struct MarkersT * m,
+  const char * text,
+  size_t len,
+  size_t * from,
+  uint64_t * lines,
+  size_t * start,
+  size_t * end,
+  size_t * text_at
+)
+/*
+  Finds the first question or answer line in [*from, len), *from
+  being a line start, from the same mask as index_cards(). Returns
+  its kind with `*start`, `*end` (before any '\r') and `*text_at`
+  as offsets into `text`; *from moves past its newline and *lines
+  counts the newlines passed. When no complete one is left returns
+  SFLASH_LINE_OTHER with *from at the incomplete line.
+*/
+{
+  size_t iLineStart = *from;
+  size_t iDelim = 0;
+  int have_delim = 0;
+  char tail[64];
+
+  for(size_t iBlock = *from; iBlock < len; iBlock += 64)
+  {
+    uint64_t mask;
+    if(len - iBlock >= 64)
+      mask = line_mask(m, text + iBlock);
+    else
+    {
+      memset(tail, 0, sizeof(tail));
+      memcpy(tail, text + iBlock, len - iBlock);
+      mask = line_mask(m, tail);
+    }
+
+    for(; mask; mask &= mask - 1)
+    {
+      size_t iPos = iBlock + __builtin_ctzll(mask);
+      if(text[iPos] != '\n')
+      {
+        if(!have_delim)
+        {
+          iDelim = iPos;
+          have_delim = 1;
+        }
+        continue;
+      }
+
+      size_t iThisStart = iLineStart;
+      size_t iLineEnd = iPos;
+      if(iLineEnd > iThisStart && text[iLineEnd - 1] == '\r')
+        --iLineEnd;
+      iLineStart = iPos + 1;
+      *lines += 1;
+      if(have_delim && iDelim < iLineEnd)
+      {
+        sflash_line kind = line_kind(m, text + iThisStart,
+          iLineEnd - iThisStart, text_at);
+        if(kind != SFLASH_LINE_OTHER)
+        {
+          *from = iLineStart;
+          *start = iThisStart;
+          *end = iLineEnd;
+          *text_at += iThisStart;
+          return kind;
+        }
+      }
+      have_delim = 0;
+    }
+  }
+  *from = iLineStart;
+  return SFLASH_LINE_OTHER;
+}
+
+SPECIALIZED size_t index_questions
+(
+  const struct MarkersT * m,
+  const char * text,
+  size_t len,
+  uint64_t base,
+  sflash_offsets * table,
+  int * ok
+)
+/*
+  Pushes `base` plus the start of every question line in `text`,
+  up to the last complete line. Returns where that one ends.
+*/
+{
+  size_t iFrom = 0;
+  size_t iStart = 0;
+  size_t iEnd = 0;
+  size_t iText = 0;
+  uint64_t iLines = 0;
+  sflash_line kind;
+  while((kind = next_line(m, text, len, &iFrom, &iLines, &iStart, &iEnd, &iText))
+    != SFLASH_LINE_OTHER)
+  {
+    if(kind == SFLASH_LINE_QUESTION && !sflash_offsets_push(table, base + iStart))
+    {
+      *ok = 0;
+      break;
+    }
+  }
+  return iFrom;
+}
+
+/* Dialects */
+
+/* id, name, markers, separator, trim */
+#define SFLASH_DIALECTS(X) \
+  X(default, "default", "-", "+", ',', 0) \
+  X(qa, "qa", "Q:", "A:", ',', 1) \
+  X(semicolon, "semicolon", "-", "+", ';', 0) \
+  X(qa_semicolon, "qa-semicolon", "Q:", "A:", ';', 1)
+
+#define DEFINE_DIALECT(id, name, question, answer, separator, trim) \
+  static const struct MarkersT markers_##id = \
+    {question, answer, separator, trim}; \
+  static sflash_line line_kind_##id(const char * line, size_t len, \
+    size_t * text) \
+  { \
+    return line_kind(&markers_##id, line, len, text); \
+  } \
+  static size_t split_##id(sflash_kind kind, const char * src, size_t len, \
+    char * buf, sflash_span * items, size_t max_items, int escapes) \
+  { \
+    return split(&markers_##id, kind, src, len, buf, items, max_items, \
+      escapes); \
+  } \
+  static sflash_deck * index_cards_##id(sflash_deck * deck, \
+    sflash_error * err) \
+  { \
+    return index_cards(&markers_##id, deck, err); \
+  } \
+  static size_t index_questions_##id(const char * text, size_t len, \
+    uint64_t base, sflash_offsets * table, int * ok) \
+  { \
+    return index_questions(&markers_##id, text, len, base, table, ok); \
+  } \
+  static sflash_line next_line_##id(const char * text, size_t len, \
+    size_t * from, uint64_t * lines, size_t * start, size_t * end, \
+    size_t * text_at) \
+  { \
+    return next_line(&markers_##id, text, len, from, lines, start, end, \
+      text_at); \
+  }
+
+#define LIST_DIALECT(id, name, question, answer, separator, trim) \
+  {name, &markers_##id, line_kind_##id, split_##id, index_cards_##id, \
+    index_questions_##id, next_line_##id},
+
+SFLASH_DIALECTS(DEFINE_DIALECT)
+
+static const struct sflash_dialect dialects[] =
+{
+  SFLASH_DIALECTS(LIST_DIALECT)
+};
+
+/* NULL stands for the default dialect */
+#define DIALECT(d) ((d) ? (d) : dialects)
+
+const sflash_dialect * sflash_dialect_find
+(
+  const char * name
+)
+{
+  for(size_t i = 0; i < sizeof(dialects) / sizeof(dialects[0]); ++i)
+  {
+    if(!strcmp(dialects[i].szName, name))
+      return dialects + i;
+  }
+  return NULL;
+}
+
+const sflash_dialect * sflash_dialect_at
+(
+  size_t index
+)
+{
+  return index < sizeof(dialects) / sizeof(dialects[0]) ? dialects + index : NULL;
+}
+
+const char * sflash_dialect_name
+(
+  const sflash_dialect * dialect
+)
+{
+  return DIALECT(dialect)->szName;
+}
+
+const char * sflash_dialect_marker
+(
+  const sflash_dialect * dialect,
+  sflash_line kind
+)
+{
+  const struct MarkersT * m = DIALECT(dialect)->markers;
+  return kind == SFLASH_LINE_QUESTION ? m->szQuestion : m->szAnswer;
+}
+
+char sflash_dialect_separator
+(
+  const sflash_dialect * dialect
+)
+{
+  return DIALECT(dialect)->markers->cSeparator;
+}
+
+sflash_line sflash_line_kind
+(
+  const sflash_dialect * dialect,
+  const char * line,
+  size_t len,
+  size_t * text
+)
+{
+  return DIALECT(dialect)->line_kind(line, len, text);
+}
+
+size_t sflash_split
+(
+  const sflash_dialect * dialect,
+  sflash_kind kind,
+  const char * src,
+  size_t len,
+  char * buf,
+  sflash_span * items,
+  size_t max_items
+)
+{
+  return DIALECT(dialect)->split(kind, src, len, buf, items, max_items, 1);
+}
+
+size_t sflash_split_input
+(
+  const sflash_dialect * dialect,
+  sflash_kind kind,
+  const char * src,
+  size_t len,
+  char * buf,
+  sflash_span * items,
+  size_t max_items
+)
+{
+  return DIALECT(dialect)->split(kind, src, len, buf, items, max_items, 0);
+}
+
+static sflash_deck * adopt_text
+(
+  char * szText,
+  size_t iLen,
+  const sflash_dialect * dialect,
+  sflash_error * err
+)
+/*
+  Takes ownership of `szText`, which must have room
+  for one byte past `iLen`
+*/
+{
+  sflash_deck * deck = calloc(1, sizeof(sflash_deck));
+  if(!deck)
+  {
+    free(szText);
+    set_error(err, SFLASH_ERR_NOMEM, 0, 0, "out of memory");
+    return NULL;
+  }
+  /* a last line without a newline still ends */
+  if(!iLen || szText[iLen - 1] != '\n')
+    szText[iLen++] = '\n';
+  deck->szText = szText;
+  deck->iLen = iLen;
+  if(!DIALECT(dialect)->index_cards(deck, err))
+  {
+    sflash_deck_close(deck);
+    return NULL;
+  }
+  return deck;
+}
+
+sflash_deck * sflash_deck_parse
+(
+  const char * text,
+  size_t len,
+  const sflash_dialect * dialect,
+  sflash_error * err
+)
+{
+  char * szText = malloc(len + 1);
+  if(!szText)
+  {
+    set_error(err, SFLASH_ERR_NOMEM, 0, 0, "out of memory");
+    return NULL;
+  }
+  memcpy(szText, text, len);
+  return adopt_text(szText, len, dialect, err);
+}
+
+sflash_deck * sflash_deck_read
+(
+  FILE * file,
+  const sflash_dialect * dialect,
+  sflash_error * err
+)
+{
+  static const size_t kiChunk = 1 << 20;
+  size_t iLen = 0;
+  size_t iCapacity = kiChunk;
+  char * szText = malloc(iCapacity + 1);
+  size_t iRead = 0;
+
+  while(szText && (iRead = fread(szText + iLen, 1, iCapacity - iLen, file)) > 0)
+  {
+    iLen += iRead;
+    if(iLen == iCapacity)
+    {
+      char * szGrown = realloc(szText, iCapacity * 2 + 1);
+      if(!szGrown)
+      {
+        free(szText);
+        szText = NULL;
+        break;
+      }
+      szText = szGrown;
+      iCapacity *= 2;
+    }
+  }
+  if(!szText)
+  {
+    set_error(err, SFLASH_ERR_NOMEM, 0, 0, "out of memory");
+    return NULL;
+  }
+  if(ferror(file))
+  {
+    free(szText);
+    set_error(err, SFLASH_ERR_IO, 0, 0, "read error");
+    return NULL;
+  }
+  return adopt_text(szText, iLen, dialect, err);
+}
+
+sflash_deck * sflash_deck_open
+(
+  const char * path,
+  const sflash_dialect * dialect,
+  sflash_error * err
+)
+{
+  FILE * file = fopen(path, "rb");
+  if(!file)
+  {
+    set_error(err, SFLASH_ERR_IO, 0, 0, "file not found");
+    return NULL;
+  }
+  sflash_deck * deck = sflash_deck_read(file, dialect, err);
+  fclose(file);
+  return deck;
+}
+
+int sflash_deck_offsets
+(
+  FILE * file,
+  const sflash_dialect * dialect,
+  sflash_offsets * table,
+  sflash_error * err
+)
+/*
+  Streams the file through a chunk buffer: only the incomplete
+  last line of a chunk is carried over to the next one
+*/
+{
+  static const size_t kiChunk = 1 << 20;
+  long iStart = ftell(file);
+  uint64_t iBase = iStart > 0 ? (uint64_t) iStart : 0;
+  size_t iCapacity = kiChunk;
+  size_t iLen = 0;
+  char * szBuf = malloc(iCapacity + 1);
+  int ok = szBuf != NULL;
+  int at_end = 0;
+
+  while(ok && !at_end)
+  {
+    if(iLen == iCapacity)
+    {
+      /* a line longer than the buffer */
+      char * szGrown = realloc(szBuf, iCapacity * 2 + 1);
+      if(!szGrown)
+      {
+        ok = 0;
+        break;
+      }
+      szBuf = szGrown;
+      iCapacity *= 2;
+    }
+    size_t iRead = fread(szBuf + iLen, 1, iCapacity - iLen, file);
+    iLen += iRead;
+    if(!iRead)
+    {
+      if(ferror(file))
+      {
+        free(szBuf);
+        set_error(err, SFLASH_ERR_IO, 0, 0, "read error");
+        return 0;
+      }
+      /* a last line without a newline still ends */
+      at_end = 1;
+      if(iLen && szBuf[iLen - 1] != '\n')
+        szBuf[iLen++] = '\n';
+    }
+    size_t iDone = DIALECT(dialect)->index_questions(szBuf, iLen, iBase,
+      table, &ok);
+    memmove(szBuf, szBuf + iDone, iLen - iDone);
+    iLen -= iDone;
+    iBase += iDone;
+  }
+  free(szBuf);
+  if(!ok)
+  {
+    set_error(err, SFLASH_ERR_NOMEM, 0, 0, "out of memory");
+    return 0;
+  }
+  set_error(err, SFLASH_OK, 0, 0, "");
+  return 1;
+}
+
+void sflash_deck_close
+(
+  sflash_deck * deck
+)
+{
+  if(!deck)
+    return;
+  free(deck->szText);
+  free(deck->pCards);
+  free(deck);
+}
+
+size_t sflash_deck_count
+(
+  const sflash_deck * deck
+)
+{
+  return deck->iCards;
+}
+
+int sflash_deck_card
+(
+  const sflash_deck * deck,
+  size_t index,
+  sflash_card * card
+)
+{
+  if(index >= deck->iCards)
+    return 0;
+  const struct CardT * src = deck->pCards + index;
+  card->question = deck->szText + src->iQuestion;
+  card->question_len = src->iQuestionLen;
+  card->answer = deck->szText + src->iAnswer;
+  card->answer_len = src->iAnswerLen;
+  card->offset = src->iQuestion - 1;
+  while(card->offset > 0 && deck->szText[card->offset - 1] != '\n')
+    --card->offset;
+  card->line = src->iLine;
+  card->kind = sflash_answer_kind(card->answer, card->answer_len);
+  return 1;
+}
+
+/* Reading card by card */
+
+#define READER_FIRST_READ 4096
+#define READER_CHUNK (1 << 20)
+
+sflash_reader * sflash_reader_open
+(
+  FILE * file,
+  const sflash_dialect * dialect
+)
+{
+  sflash_reader * reader = calloc(1, sizeof(sflash_reader));
+  if(!reader)
+    return NULL;
+  long iStart = ftell(file);
+  reader->file = file;
+  reader->dialect = DIALECT(dialect);
+  reader->iBase = iStart > 0 ? (uint64_t) iStart : 0;
+  reader->iLine = iStart > 0 ? 0 : 1;
+  reader->iReadAhead = READER_FIRST_READ;
+  return reader;
+}
+
+void sflash_reader_close
+(
+  sflash_reader * reader
+)
+{
+  if(!reader)
+    return;
+  free(reader->szBuf);
+  free(reader);
+}
+
+void sflash_reader_seek
+(
+  sflash_reader * reader,
+  uint64_t offset,
+  uint64_t line,
+  int resync
+)
+/*
+  Text already read is kept when `offset` falls in it, so
+  skipping ahead over a few cards costs no read
+*/
+{
+  if(offset == reader->iBase + reader->iPos)
+  {
+    if(line)
+      reader->iLine = line;
+    return;
+  }
+  if(offset >= reader->iBase && offset < reader->iBase + reader->iLen)
+    reader->iPos = offset - reader->iBase;
+  else
+  {
+    reader->iBase = offset;
+    reader->iLen = 0;
+    reader->iPos = 0;
+    reader->iReadAhead = READER_FIRST_READ;
+    reader->at_end = 0;
+  }
+  reader->iLine = line;
+  reader->resync = resync;
+}
+
+uint64_t sflash_reader_tell
+(
+  const sflash_reader * reader,
+  uint64_t * line
+)
+{
+  if(line)
+    *line = reader->iLine;
+  return reader->iBase + reader->iPos;
+}
+
+void sflash_reader_drop
+(
+  sflash_reader * reader
+)
+{
+  reader->iBase += reader->iPos;
+  reader->iLen = 0;
+  reader->iPos = 0;
+  reader->iReadAhead = READER_FIRST_READ;
+  reader->at_end = 0;
+}
+
+static int reader_fill
+(
+  sflash_reader * reader,
+  size_t iKeep,
+  sflash_error * err
+)
+/*
+  Drops the text before `iKeep` and reads more after the rest
+*/
+{
+  memmove(reader->szBuf, reader->szBuf + iKeep, reader->iLen - iKeep);
+  reader->iLen -= iKeep;
+  reader->iPos -= iKeep;
+  reader->iBase += iKeep;
+
+  if(reader->iCapacity - reader->iLen < reader->iReadAhead + 1)
+  {
+    size_t iCapacity = reader->iLen + reader->iReadAhead + 1;
+    char * szGrown = realloc(reader->szBuf, iCapacity);
+    if(!szGrown)
+    {
+      set_error(err, SFLASH_ERR_NOMEM, 0, 0, "out of memory");
+      return 0;
+    }
+    reader->szBuf = szGrown;
+    reader->iCapacity = iCapacity;
+  }
+  if(fseek(reader->file, (long) (reader->iBase + reader->iLen), SEEK_SET))
+  {
+    set_error(err, SFLASH_ERR_IO, 0, 0, "seek failed");
+    return 0;
+  }
+  size_t iRead = fread(reader->szBuf + reader->iLen, 1, reader->iReadAhead,
+    reader->file);
+  reader->iLen += iRead;
+  if(reader->iReadAhead < READER_CHUNK)
+    reader->iReadAhead *= 2;
+  if(!iRead)
+  {
+    if(ferror(reader->file))
+    {
+      set_error(err, SFLASH_ERR_IO, 0, 0, "read error");
+      return 0;
+    }
+    /* a last line without a newline still ends */
+    reader->at_end = 1;
+    if(reader->iLen && reader->szBuf[reader->iLen - 1] != '\n')
+      reader->szBuf[reader->iLen++] = '\n';
+  }
+  return 1;
+}
+
+int sflash_reader_skip
+(
+  sflash_reader * reader,
+  uint64_t lines,
+  sflash_error * err
+)
+/*
+  Newlines are counted and found with byte_mask over the buffer;
+  the text skipped over stays there for the cards after it
+*/
+{
+  uint64_t iLeft = lines;
+  while(iLeft)
+  {
+    const char * p = reader->szBuf + reader->iPos;
+    size_t iAvail = reader->iLen - reader->iPos;
+    size_t iAt = sflash_find_nth_byte(p, iAvail, '\n', iLeft);
+    if(iAt < iAvail)
+    {
+      reader->iPos += iAt + 1;
+      iLeft = 0;
+      break;
+    }
+    /* all of the complete lines here, then read on */
+    uint64_t iHere = sflash_count_byte(p, iAvail, '\n');
+    if(iHere)
+      reader->iPos += sflash_find_nth_byte(p, iAvail, '\n', iHere) + 1;
+    iLeft -= iHere;
+    if(reader->at_end)
+      break;
+    if(!reader_fill(reader, reader->iPos, err))
+      return -1;
+  }
+  if(reader->iLine)
+    reader->iLine += lines - iLeft;
+  if(lines)
+  {
+    reader->resync = 1;
+  }
+  set_error(err, SFLASH_OK, 0, 0, "");
+  return !iLeft;
+}
+
+int sflash_reader_next
+(
+  sflash_reader * reader,
+  sflash_card * card,
+  sflash_error * err
+)
+/*
+  Lines are found with the dialect's next_line kernel; the
+  buffer is refilled only when no complete line is left
+*/
+{
+  size_t iQuestion = 0;
+  size_t iQuestionText = 0;
+  size_t iQuestionEnd = 0;
+  uint64_t iQuestionLine = 0;
+  int have_question = 0;
+
+  for(;;)
+  {
+    size_t iStart = 0;
+    size_t iEnd = 0;
+    size_t iText = 0;
+    uint64_t iLines = 0;
+    sflash_line kind = reader->dialect->next_line(reader->szBuf, reader->iLen,
+      &reader->iPos, &iLines, &iStart, &iEnd, &iText);
+    uint64_t iLine = reader->iLine ? reader->iLine + iLines - 1 : 0;
+    if(reader->iLine)
+      reader->iLine += iLines;
+
+    if(kind == SFLASH_LINE_OTHER)
+    {
+      if(reader->at_end)
+      {
+        if(have_question)
+        {
+          set_error(err, SFLASH_ERR_SYNTAX, iQuestionLine, 1,
+            "unmatched question/answer pair: question has no answer");
+          return -1;
+        }
+        set_error(err, SFLASH_OK, 0, 0, "");
+        return 0;
+      }
+      /* a card being read stays in the buffer */
+      size_t iKeep = have_question ? iQuestion : reader->iPos;
+      if(!reader_fill(reader, iKeep, err))
+        return -1;
+      if(have_question)
+      {
+        iQuestion -= iKeep;
+        iQuestionText -= iKeep;
+        iQuestionEnd -= iKeep;
+      }
+      continue;
+    }
+
+    if(kind == SFLASH_LINE_QUESTION)
+    {
+      if(have_question)
+      {
+        set_error(err, SFLASH_ERR_SYNTAX, iQuestionLine, 1,
+          "unmatched question/answer pair: question has no answer");
+        return -1;
+      }
+      iQuestion = iStart;
+      iQuestionText = iText;
+      iQuestionEnd = iEnd;
+      iQuestionLine = iLine;
+      have_question = 1;
+      reader->resync = 0;
+      continue;
+    }
+
+    if(!have_question)
+    {
+      if(reader->resync)
+        continue;
+      set_error(err, SFLASH_ERR_SYNTAX, iLine, 1,
+        "unmatched question/answer pair: answer has no question");
+      return -1;
+    }
+    card->question = reader->szBuf + iQuestionText;
+    card->question_len = iQuestionEnd - iQuestionText;
+    card->answer = reader->szBuf + iText;
+    card->answer_len = iEnd - iText;
+    card->offset = reader->iBase + iQuestion;
+    card->line = iQuestionLine;
+    card->kind = sflash_answer_kind(card->answer, card->answer_len);
+    set_error(err, SFLASH_OK, 0, 0, "");
+    return 1;
+  }
+}
+
+/* Grading */
+
+double sflash_grade_score
+(
+  const sflash_grade * grade
+)
+{
+  if(grade->total_weight > 0.0)
+    return grade->matched_weight / grade->total_weight;
+  return (double) grade->matches / (double) grade->total;
+}
+
+void sflash_grade_words
+(
+  const sflash_span * real,
+  const float * weights,
+  size_t n_real,
+  const sflash_span * given,
+  size_t n_given,
+  sflash_grade * grade
+)
+/*
+  Short answers compare every pair; long ones hash the
+  real words first so grading stays linear, falling back to
+  every pair when the table cannot be had
+*/
+{
+  static const size_t kiPairwise = 4096;
+
+  grade->matches = 0;
+  grade->total = n_real;
+  grade->matched_weight = 0.0;
+  grade->total_weight = 0.0;
+  if(weights)
+  {
+    for(size_t r = 0; r < n_real; ++r)
+      grade->total_weight += weights[r];
+  }
+
+  uint32_t * pSlots = NULL;
+  uint32_t * pCounts = NULL;
+  double * pWeights = NULL;
+  size_t iSlots = 16;
+  if(n_real * n_given > kiPairwise)
+  {
+    /* slots hold the first real index of each distinct word + 1 */
+    while(iSlots < n_real * 2)
+      iSlots *= 2;
+    pSlots = calloc(iSlots, sizeof(uint32_t));
+    pCounts = calloc(n_real, sizeof(uint32_t));
+    pWeights = calloc(n_real, sizeof(double));
+  }
+  if(!pSlots || !pCounts || !pWeights)
+  {
+    free(pSlots);
+    free(pCounts);
+    free(pWeights);
+    for(size_t r = 0; r < n_real; ++r)
+    {
+      for(size_t g = 0; g < n_given; ++g)
+      {
+        if(span_eq(real[r].text, real[r].len, given[g].text, given[g].len))
+        {
+          grade->matches += 1;
+          if(weights)
+            grade->matched_weight += weights[r];
+        }
+      }
+    }
+    return;
+  }
+
+  for(size_t r = 0; r < n_real; ++r)
+  {
+    size_t s = hash_span(real[r].text, real[r].len) & (iSlots - 1);
+    while(pSlots[s] && !span_eq(real[pSlots[s] - 1].text, real[pSlots[s] - 1].len,
+      real[r].text, real[r].len))
+    {
+      s = (s + 1) & (iSlots - 1);
+    }
+    if(!pSlots[s])
+      pSlots[s] = r + 1;
+    pCounts[pSlots[s] - 1] += 1;
+    if(weights)
+      pWeights[pSlots[s] - 1] += weights[r];
+  }
+  for(size_t g = 0; g < n_given; ++g)
+  {
+    size_t s = hash_span(given[g].text, given[g].len) & (iSlots - 1);
+    for(; pSlots[s]; s = (s + 1) & (iSlots - 1))
+    {
+      const sflash_span * word = real + pSlots[s] - 1;
+      if(span_eq(word->text, word->len, given[g].text, given[g].len))
+      {
+        grade->matches += pCounts[pSlots[s] - 1];
+        grade->matched_weight += pWeights[pSlots[s] - 1];
+        break;
+      }
+    }
+  }
+  free(pSlots);
+  free(pCounts);
+  free(pWeights);
+}
+
+long sflash_find_item
+(
+  const sflash_span * items,
+  size_t n,
+  const char * given,
+  size_t len
+)
+{
+  for(size_t i = 0; i < n; ++i)
+  {
+    if(span_eq(items[i].text, items[i].len, given, len))
+      return i;
+  }
+  return -1;
+}
+
+static long sequence_id
+(
+  const sflash_sequence * seq,
+  const char * text,
+  size_t len
+)
+{
+  size_t s = hash_span(text, len) & (seq->iSlots - 1);
+  for(; seq->pSlots[s]; s = (s + 1) & (seq->iSlots - 1))
+  {
+    const sflash_span * key = seq->pKeys + seq->pSlots[s] - 1;
+    if(span_eq(key->text, key->len, text, len))
+      return seq->pSlots[s] - 1;
+  }
+  return -1;
+}
+
+sflash_sequence * sflash_sequence_compile
+(
+  const sflash_span * items,
+  size_t n
+)
+/*
+  Gives every distinct item an id and precomputes, per id,
+  the bitmask of positions it holds in the sequence, as the
+  bit-parallel LCS in sflash_sequence_grade() needs
+*/
+{
+  sflash_sequence * seq = calloc(1, sizeof(sflash_sequence));
+  if(!seq)
+    return NULL;
+  size_t iPool = 0;
+  for(size_t i = 0; i < n; ++i)
+    iPool += items[i].len;
+
+  seq->iItems = n;
+  seq->iWords = (n + 63) / 64;
+  seq->iSlots = 16;
+  while(seq->iSlots < n * 2)
+    seq->iSlots *= 2;
+  seq->pSlots = calloc(seq->iSlots, sizeof(uint32_t));
+  seq->pKeys = calloc(n + 1, sizeof(sflash_span));
+  seq->pCounts = calloc(n + 1, sizeof(uint32_t));
+  seq->pMasks = calloc((n + 1) * (seq->iWords + 1), sizeof(uint64_t));
+  seq->szPool = malloc(iPool + 1);
+  if(!seq->pSlots || !seq->pKeys || !seq->pCounts || !seq->pMasks || !seq->szPool)
+  {
+    sflash_sequence_free(seq);
+    return NULL;
+  }
+
+  char * pPool = seq->szPool;
+  for(size_t i = 0; i < n; ++i)
+  {
+    long id = sequence_id(seq, items[i].text, items[i].len);
+    if(id < 0)
+    {
+      size_t s = hash_span(items[i].text, items[i].len) & (seq->iSlots - 1);
+      while(seq->pSlots[s])
+        s = (s + 1) & (seq->iSlots - 1);
+      id = seq->iIds++;
+      seq->pSlots[s] = id + 1;
+      memcpy(pPool, items[i].text, items[i].len);
+      seq->pKeys[id].text = pPool;
+      seq->pKeys[id].len = items[i].len;
+      pPool += items[i].len;
+    }
+    seq->pCounts[id] += 1;
+    seq->pMasks[id * seq->iWords + i / 64] |= (uint64_t) 1 << (i % 64);
+  }
+  return seq;
+}
+
+void sflash_sequence_free
+(
+  sflash_sequence * seq
+)
+{
+  if(!seq)
+    return;
+  free(seq->pSlots);
+  free(seq->pKeys);
+  free(seq->pCounts);
+  free(seq->pMasks);
+  free(seq->szPool);
+  free(seq);
+}
+
+void sflash_sequence_grade
+(
+  const sflash_sequence * seq,
+  const sflash_span * given,
+  size_t n,
+  sflash_grade * grade,
+  uint32_t * present
+)
+/*
+  LCS 64 items per machine word (Allison-Dix / Hyyrö):
+  V' = (V + (V & M)) | (V & ~M), LCS = zero bits of V
+*/
+{
+  grade->matches = 0;
+  grade->total = seq->iItems;
+  grade->matched_weight = 0.0;
+  grade->total_weight = 0.0;
+  *present = 0;
+
+  uint64_t * V = malloc((seq->iWords + 1) * sizeof(uint64_t));
+  unsigned char * pSeen = calloc(seq->iIds + 1, 1);
+  if(!V || !pSeen)
+  {
+    free(V);
+    free(pSeen);
+    return;
+  }
+  for(size_t w = 0; w < seq->iWords; ++w)
+    V[w] = ~(uint64_t) 0;
+
+  for(size_t g = 0; g < n; ++g)
+  {
+    long id = sequence_id(seq, given[g].text, given[g].len);
+    if(id < 0)
+      continue;
+    if(!pSeen[id])
+    {
+      pSeen[id] = 1;
+      *present += seq->pCounts[id];
+    }
+
+    const uint64_t * M = seq->pMasks + id * seq->iWords;
+    uint64_t carry = 0;
+    for(size_t w = 0; w < seq->iWords; ++w)
+    {
+      uint64_t U = V[w] & M[w];
+      uint64_t sum = V[w] + U;
+      uint64_t carry_out = sum < V[w];
+      sum += carry;
+      carry_out |= sum < carry;
+      V[w] = sum | (V[w] - U);
+      carry = carry_out;
+    }
+  }
+
+  for(size_t w = 0; w < seq->iWords; ++w)
+  {
+    uint64_t valid = ~(uint64_t) 0;
+    if(w == seq->iWords - 1 && seq->iItems % 64)
+      valid = ((uint64_t) 1 << (seq->iItems % 64)) - 1;
+    grade->matches += __builtin_popcountll(~V[w] & valid);
+  }
+  free(V);
+  free(pSeen);
+}
+
+/* Offset tables */
+
+#define OFFSETS_BLOCK 256
+
+struct OffsetBlockT
+{
+  uint64_t iBase;  /* first offset of the block */
+  uint64_t iBit;   /* where its bits start in pWords */
+  uint32_t iHighs; /* bits of the high part */
+  uint8_t iLowBits;
+};
+
+struct sflash_offsets
+{
+  struct OffsetBlockT * pBlocks;
+  size_t iBlocks;
+  size_t iBlocksCap;
+  uint64_t * pWords;
+  uint64_t iBits;
+  size_t iWordsCap;
+  uint64_t pPending[OFFSETS_BLOCK]; /* not yet coded, the last block */
+  size_t iPending;
+};
+
+sflash_offsets * sflash_offsets_new(void)
+{
+  return calloc(1, sizeof(sflash_offsets));
+}
+
+void sflash_offsets_free
+(
+  sflash_offsets * table
+)
+{
+  if(!table)
+    return;
+  free(table->pBlocks);
+  free(table->pWords);
+  free(table);
+}
+
+static int put_bits
+(
+  sflash_offsets * table,
+  uint64_t iBit,
+  uint64_t value,
+  uint8_t iWidth
+)
+/*
+  The bits must be zero already
+*/
+{
+  size_t iNeeded = (iBit + iWidth + 63) / 64 + 1;
+  if(iNeeded > table->iWordsCap)
+  {
+    size_t iCap = table->iWordsCap ? table->iWordsCap * 2 : 256;
+    while(iCap < iNeeded)
+      iCap *= 2;
+    uint64_t * pWords = realloc(table->pWords, iCap * sizeof(uint64_t));
+    if(!pWords)
+      return 0;
+    memset(pWords + table->iWordsCap, 0, (iCap - table->iWordsCap) * sizeof(uint64_t));
+    table->pWords = pWords;
+    table->iWordsCap = iCap;
+  }
+  if(!iWidth)
+    return 1;
+  if(iWidth < 64)
+    value &= ((uint64_t) 1 << iWidth) - 1;
+  uint64_t * pWord = table->pWords + iBit / 64;
+  unsigned iShift = iBit % 64;
+  pWord[0] |= value << iShift;
+  if(iShift + iWidth > 64)
+    pWord[1] |= value >> (64 - iShift);
+  return 1;
+}
+
+static uint64_t get_bits
+(
+  const uint64_t * pWords,
+  uint64_t iBit,
+  uint8_t iWidth
+)
+{
+  if(!iWidth)
+    return 0;
+  const uint64_t * pWord = pWords + iBit / 64;
+  unsigned iShift = iBit % 64;
+  uint64_t value = pWord[0] >> iShift;
+  if(iShift + iWidth > 64)
+    value |= pWord[1] << (64 - iShift);
+  if(iWidth < 64)
+    value &= ((uint64_t) 1 << iWidth) - 1;
+  return value;
+}
+
+static int code_block
+(
+  sflash_offsets * table
+)
+/*
+  Elias-Fano codes the pending offsets relative to the first:
+  the low iLowBits of each delta are stored as they are, the
+  rest in unary, one set bit per offset at (high + index)
+*/
+{
+  if(table->iBlocks == table->iBlocksCap)
+  {
+    size_t iCap = table->iBlocksCap ? table->iBlocksCap * 2 : 64;
+    struct OffsetBlockT * pBlocks = realloc(table->pBlocks,
+      iCap * sizeof(struct OffsetBlockT));
+    if(!pBlocks)
+      return 0;
+    table->pBlocks = pBlocks;
+    table->iBlocksCap = iCap;
+  }
+
+  const uint64_t * pValues = table->pPending;
+  size_t n = table->iPending;
+  uint64_t iRange = pValues[n - 1] - pValues[0];
+  uint8_t iLowBits = 0;
+  while(iLowBits < 63 && (iRange / n) >> (iLowBits + 1))
+    ++iLowBits;
+
+  struct OffsetBlockT block;
+  block.iBase = pValues[0];
+  block.iBit = table->iBits;
+  block.iLowBits = iLowBits;
+  block.iHighs = (iRange >> iLowBits) + n;
+
+  uint64_t iLows = block.iBit;
+  uint64_t iHighs = iLows + n * iLowBits;
+  if(!put_bits(table, iHighs + block.iHighs, 0, 0))
+    return 0;
+  for(size_t i = 0; i < n; ++i)
+  {
+    uint64_t iDelta = pValues[i] - block.iBase;
+    put_bits(table, iLows + i * iLowBits, iDelta, iLowBits);
+    put_bits(table, iHighs + (iDelta >> iLowBits) + i, 1, 1);
+  }
+  table->iBits = iHighs + block.iHighs;
+  table->pBlocks[table->iBlocks++] = block;
+  table->iPending = 0;
+  return 1;
+}
+
+int sflash_offsets_push
+(
+  sflash_offsets * table,
+  uint64_t offset
+)
+{
+  if(table->iPending)
+  {
+    if(offset < table->pPending[table->iPending - 1])
+      return 0;
+  }
+  else if(table->iBlocks)
+  {
+    size_t iLast = table->iBlocks * OFFSETS_BLOCK - 1;
+    if(offset < sflash_offsets_get(table, iLast))
+      return 0;
+  }
+  table->pPending[table->iPending++] = offset;
+  if(table->iPending == OFFSETS_BLOCK && !code_block(table))
+  {
+    /* code_block fails before changing anything, so taking the
+       offset back leaves room for the next push */
+    --table->iPending;
+    return 0;
+  }
+  return 1;
+}
+
+size_t sflash_offsets_count
+(
+  const sflash_offsets * table
+)
+{
+  return table->iBlocks * OFFSETS_BLOCK + table->iPending;
+}
+
+uint64_t sflash_offsets_get
+(
+  const sflash_offsets * table,
+  size_t index
+)
+{
+  size_t iBlock = index / OFFSETS_BLOCK;
+  size_t i = index % OFFSETS_BLOCK;
+  if(iBlock == table->iBlocks)
+    return table->pPending[i];
+
+  const struct OffsetBlockT * block = table->pBlocks + iBlock;
+  uint64_t iLows = block->iBit;
+  uint64_t iHighs = iLows + (uint64_t) OFFSETS_BLOCK * block->iLowBits;
+  uint64_t iLow = get_bits(table->pWords, iLows + i * block->iLowBits,
+    block->iLowBits);
+
+  /* select the ith set bit; a block's highs span under 3 * 256 bits */
+  uint64_t iBit = iHighs;
+  uint64_t iEnd = iHighs + block->iHighs;
+  size_t iLeft = i;
+  for(;;)
+  {
+    uint8_t iWidth = iEnd - iBit < 64 ? iEnd - iBit : 64;
+    uint64_t word = get_bits(table->pWords, iBit, iWidth);
+    size_t iOnes = __builtin_popcountll(word);
+    if(iLeft < iOnes)
+    {
+      while(iLeft--)
+        word &= word - 1;
+      iBit += __builtin_ctzll(word);
+      break;
+    }
+    iLeft -= iOnes;
+    iBit += iWidth;
+  }
+  uint64_t iHigh = iBit - iHighs - i;
+  return block->iBase + ((iHigh << block->iLowBits) | iLow);
+}
+
+size_t sflash_offsets_find
+(
+  const sflash_offsets * table,
+  uint64_t offset
+)
+{
+  size_t iCount = sflash_offsets_count(table);
+  if(!iCount || sflash_offsets_get(table, 0) > offset)
+    return iCount;
+
+  /* last block starting at or before `offset`, then within it */
+  size_t iLo = 0;
+  size_t iHi = table->iBlocks;
+  while(iLo < iHi)
+  {
+    size_t iMid = (iLo + iHi) / 2;
+    if(table->pBlocks[iMid].iBase <= offset)
+      iLo = iMid + 1;
+    else
+      iHi = iMid;
+  }
+  if(table->iPending && table->pPending[0] <= offset)
+    iLo = table->iBlocks + 1;
+
+  size_t iFirst = (iLo - 1) * OFFSETS_BLOCK;
+  size_t iLast = iFirst + OFFSETS_BLOCK < iCount ? iFirst + OFFSETS_BLOCK : iCount;
+  /* first index in [iFirst, iLast) whose offset is greater */
+  iLo = iFirst;
+  iHi = iLast;
+  while(iLo < iHi)
+  {
+    size_t iMid = (iLo + iHi) / 2;
+    if(sflash_offsets_get(table, iMid) <= offset)
+      iLo = iMid + 1;
+    else
+      iHi = iMid;
+  }
+  return iLo - 1;
+}
+
+size_t sflash_offsets_bytes
+(
+  const sflash_offsets * table
+)
+{
+  return sizeof(sflash_offsets)
+    + table->iBlocksCap * sizeof(struct OffsetBlockT)
+    + table->iWordsCap * sizeof(uint64_t);
+}
+
+/* Editing */
+
+struct LineT
+{
+  uint64_t iStart;
+  uint64_t iDelim; /* where the marker starts */
+  size_t iText;    /* where the text starts, in the line */
+  size_t iLen;  /* up to the line end, "\r\n" or "\n" */
+  char * szText;
+  sflash_line kind;
+};
+
+static int read_line
+(
+  FILE * file,
+  const sflash_dialect * dialect,
+  struct LineT * line
+)
+/*
+  Returns 0 at the end of the file
+*/
+{
+  size_t iCap = 128;
+  int c = 0;
+  line->iStart = ftell(file);
+  line->iLen = 0;
+  line->szText = malloc(iCap);
+  if(!line->szText)
+    return 0;
+  while((c = fgetc(file)) != EOF && c != '\n')
+  {
+    if(line->iLen + 1 == iCap)
+    {
+      char * szGrown = realloc(line->szText, iCap * 2);
+      if(!szGrown)
+        break;
+      line->szText = szGrown;
+      iCap *= 2;
+    }
+    line->szText[line->iLen++] = c;
+  }
+  if(line->iLen && line->szText[line->iLen - 1] == '\r')
+    --line->iLen;
+  line->kind = sflash_line_kind(dialect, line->szText, line->iLen, &line->iText);
+  size_t iBlanks = 0;
+  while(iBlanks < line->iLen
+    && (line->szText[iBlanks] == ' ' || line->szText[iBlanks] == '\t'))
+  {
+    ++iBlanks;
+  }
+  line->iDelim = line->iStart + iBlanks;
+  return c != EOF || line->iLen;
+}
+
+static int write_at
+(
+  FILE * file,
+  uint64_t offset,
+  const void * src,
+  size_t len
+)
+{
+  return !fseek(file, offset, SEEK_SET) && fwrite(src, 1, len, file) == len;
+}
+
+static int write_line
+(
+  FILE * file,
+  const struct LineT * line,
+  const char * marker,
+  const char * text,
+  size_t len
+)
+/*
+  Over the old line, blanks first, marker, then the text
+*/
+{
+  size_t iMarker = strlen(marker);
+  size_t iPad = line->iLen - len - iMarker;
+  char * buf = malloc(line->iLen);
+  if(!buf)
+    return 0;
+  memset(buf, ' ', iPad);
+  memcpy(buf + iPad, marker, iMarker);
+  memcpy(buf + iPad + iMarker, text, len);
+  int ok = write_at(file, line->iStart, buf, line->iLen);
+  free(buf);
+  return ok;
+}
+
+int64_t sflash_card_rewrite
+(
+  FILE * file,
+  uint64_t offset,
+  const char * question,
+  size_t question_len,
+  const char * answer,
+  size_t answer_len,
+  const sflash_dialect * dialect,
+  sflash_error * err
+)
+{
+  const char * szQuestion = sflash_dialect_marker(dialect, SFLASH_LINE_QUESTION);
+  const char * szAnswer = sflash_dialect_marker(dialect, SFLASH_LINE_ANSWER);
+  struct LineT lines[2];
+  struct LineT other;
+  int64_t ret = -1;
+  int iFound = 0;
+
+  lines[0].szText = lines[1].szText = NULL;
+  if(fseek(file, offset, SEEK_SET))
+  {
+    set_error(err, SFLASH_ERR_IO, 0, 0, "seek failed");
+    return -1;
+  }
+  /* blank lines may come before the question */
+  while(iFound < 2)
+  {
+    struct LineT * line = iFound ? lines + 1 : lines;
+    if(!read_line(file, dialect, line))
+    {
+      free(line->szText);
+      line->szText = NULL;
+      break;
+    }
+    sflash_line expected = iFound ? SFLASH_LINE_ANSWER : SFLASH_LINE_QUESTION;
+    if(line->kind == expected)
+    {
+      ++iFound;
+      continue;
+    }
+    other = *line;
+    free(other.szText);
+    line->szText = NULL;
+    if(other.kind != SFLASH_LINE_OTHER)
+      break;
+  }
+  if(iFound < 2)
+  {
+    set_error(err, SFLASH_ERR_SYNTAX, 0, 0, "no card at this offset");
+    goto end;
+  }
+
+  const char * pText[2] = {question, answer};
+  size_t iTextLen[2] = {question_len, answer_len};
+  for(int i = 0; i < 2; ++i)
+  {
+    if(!pText[i])
+    {
+      pText[i] = lines[i].szText + lines[i].iText;
+      iTextLen[i] = lines[i].iLen - lines[i].iText;
+    }
+  }
+
+  if(iTextLen[0] + strlen(szQuestion) <= lines[0].iLen
+    && iTextLen[1] + strlen(szAnswer) <= lines[1].iLen)
+  {
+    if(!write_line(file, lines, szQuestion, pText[0], iTextLen[0])
+      || !write_line(file, lines + 1, szAnswer, pText[1], iTextLen[1]))
+    {
+      set_error(err, SFLASH_ERR_IO, 0, 0, "write failed");
+      goto end;
+    }
+    ret = offset;
+  }
+  else
+  {
+    /* append first, so a failed write loses nothing */
+    char cLast = '\n';
+    if(fseek(file, 0, SEEK_END))
+    {
+      set_error(err, SFLASH_ERR_IO, 0, 0, "seek failed");
+      goto end;
+    }
+    int64_t iEnd = ftell(file);
+    if(iEnd > 0 && (fseek(file, -1, SEEK_END) || fread(&cLast, 1, 1, file) != 1))
+    {
+      set_error(err, SFLASH_ERR_IO, 0, 0, "read failed");
+      goto end;
+    }
+    fseek(file, 0, SEEK_END);
+    int ok = 1;
+    if(cLast != '\n')
+    {
+      ok = fputc('\n', file) != EOF;
+      ++iEnd;
+    }
+    ok = ok && fputs(szQuestion, file) != EOF
+      && fwrite(pText[0], 1, iTextLen[0], file) == iTextLen[0]
+      && fputc('\n', file) != EOF && fputs(szAnswer, file) != EOF
+      && fwrite(pText[1], 1, iTextLen[1], file) == iTextLen[1]
+      && fputc('\n', file) != EOF;
+    ok = ok && write_at(file, lines[0].iDelim, "#", 1)
+      && write_at(file, lines[1].iDelim, "#", 1);
+    if(!ok)
+    {
+      set_error(err, SFLASH_ERR_IO, 0, 0, "write failed");
+      goto end;
+    }
+    ret = iEnd;
+  }
+  if(fflush(file))
+  {
+    set_error(err, SFLASH_ERR_IO, 0, 0, "write failed");
+    ret = -1;
+    goto end;
+  }
+  set_error(err, SFLASH_OK, 0, 0, "");
+
+end:
+  free(lines[0].szText);
+  free(lines[1].szText);
+  return ret;
+}
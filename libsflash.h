@@ -0,0 +1,305 @@
+/*
+  LIBSFLASH - CORE OF THE SFLASH FLASHCARDS PROGRAM
+  License: Affero General Public License
+
+  Deck loading, card iteration and grading, shared by
+  the sflash2 and sflash3 front ends and usable from any
+  program through a plain C ABI.
+
+  Every function is reentrant: all state lives in the
+  objects passed in, nothing is kept in globals. A deck
+  may be read from several threads at once.
+
+  Build: cc -O2 -c libsflash.c (add -mavx2 for 32-byte scans)
+
+  Deck syntax:
+    -question       a line whose first non-blank char is '-'
+    +answer         a line whose first non-blank char is '+'
+    +{a, b, c}      an unordered list
+    +[a, b, c]      an ordered sequence
+    \x              makes x literal when x is one of - + { } [ ] , ; \
+                    e.g. "\-", "\{", "\,"; any other '\' is kept as is
+
+  Other dialects change the markers ("Q:" and "A:") or the
+  item separator (';'); see sflash_dialect_find().
+*/
+
+#ifndef LIBSFLASH_H
+#define LIBSFLASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bumped whenever a struct layout or signature changes */
+#define SFLASH_ABI_VERSION 2
+unsigned sflash_abi_version(void);
+
+typedef enum
+{
+  SFLASH_OK = 0,
+  SFLASH_ERR_IO,
+  SFLASH_ERR_NOMEM,
+  SFLASH_ERR_SYNTAX
+} sflash_status;
+
+typedef struct
+{
+  sflash_status status;
+  uint64_t line;   /* 1-based, 0 when not about a line */
+  uint32_t column; /* 1-based */
+  char message[96];
+} sflash_error;
+
+typedef enum
+{
+  SFLASH_TOKENS = 0, /* free text, graded word by word */
+  SFLASH_LIST,
+  SFLASH_SEQUENCE,
+  SFLASH_EMPTY
+} sflash_kind;
+
+typedef enum
+{
+  SFLASH_LINE_OTHER = 0,
+  SFLASH_LINE_QUESTION,
+  SFLASH_LINE_ANSWER
+} sflash_line;
+
+typedef struct
+{
+  const char * text;
+  size_t len;
+} sflash_span;
+
+/*
+  Text is as written in the deck, escapes included;
+  see sflash_unescape() and sflash_split()
+*/
+typedef struct
+{
+  const char * question;
+  size_t question_len;
+  const char * answer;
+  size_t answer_len;
+  uint64_t offset; /* of the question line, from where reading began */
+  uint64_t line;   /* of the question line, 1-based */
+  sflash_kind kind;
+} sflash_card;
+
+/* Dialects */
+
+/*
+  Markers and separators of a deck format, each with its own
+  parser compiled in; picked once, then passed to the functions
+  below. NULL always stands for the default dialect.
+
+    "default"       -question, +answer, items split on ','
+    "qa"            Q:question, A:answer, items split on ','
+    "semicolon"     -question, +answer, items split on ';'
+    "qa-semicolon"  Q:question, A:answer, items split on ';'
+
+  Blanks after "Q:" and "A:" are not part of the text.
+*/
+typedef struct sflash_dialect sflash_dialect;
+
+/* NULL when no dialect has that name */
+const sflash_dialect * sflash_dialect_find(const char * name);
+/* Dialects in the order above, NULL past the last */
+const sflash_dialect * sflash_dialect_at(size_t index);
+const char * sflash_dialect_name(const sflash_dialect * dialect);
+/* Starts a SFLASH_LINE_QUESTION or SFLASH_LINE_ANSWER line */
+const char * sflash_dialect_marker(const sflash_dialect * dialect, sflash_line kind);
+/* Between list and sequence items */
+char sflash_dialect_separator(const sflash_dialect * dialect);
+
+/* Decks */
+
+typedef struct sflash_deck sflash_deck;
+typedef struct sflash_offsets sflash_offsets; /* see Offset tables */
+
+sflash_deck * sflash_deck_open(const char * path,
+  const sflash_dialect * dialect, sflash_error * err);
+/* Reads from the current position to the end of `file` */
+sflash_deck * sflash_deck_read(FILE * file,
+  const sflash_dialect * dialect, sflash_error * err);
+/* Copies `text` */
+sflash_deck * sflash_deck_parse(const char * text, size_t len,
+  const sflash_dialect * dialect, sflash_error * err);
+void sflash_deck_close(sflash_deck * deck);
+
+/*
+  Pushes to `table` where every question line starts, reading
+  `file` from its current position to the end without holding
+  the deck in memory. Offsets count from the start of the file.
+  Returns 0 with `err` set on a read error or out of memory
+*/
+int sflash_deck_offsets(FILE * file, const sflash_dialect * dialect,
+  sflash_offsets * table, sflash_error * err);
+
+size_t sflash_deck_count(const sflash_deck * deck);
+/* Returns 0 when `index` is out of range */
+int sflash_deck_card(const sflash_deck * deck, size_t index, sflash_card * card);
+
+/*
+  Reading card by card: a deck of any size is stepped through
+  with a buffer of a few card lengths, read ahead in chunks
+  that grow while reading on. `file` stays the caller's; the
+  reader moves it as it needs to.
+*/
+
+typedef struct sflash_reader sflash_reader;
+
+/* Starts where `file` is; NULL when out of memory */
+sflash_reader * sflash_reader_open(FILE * file, const sflash_dialect * dialect);
+void sflash_reader_close(sflash_reader * reader);
+/*
+  Goes on from the line starting at `offset`, which is line
+  `line` (1-based, 0 when unknown, and card lines then are 0).
+  With `resync`, answers before the next question are skipped,
+  for offsets that may fall inside a card.
+*/
+void sflash_reader_seek(sflash_reader * reader, uint64_t offset,
+  uint64_t line, int resync);
+/*
+  Skips `lines` lines, then answers up to the next question.
+  Returns 1, or 0 when the file ended first; -1 with `err` set
+  on a read error
+*/
+int sflash_reader_skip(sflash_reader * reader, uint64_t lines,
+  sflash_error * err);
+/* Where the next card is looked for; `*line` gets its line */
+uint64_t sflash_reader_tell(const sflash_reader * reader, uint64_t * line);
+/* Forgets the text read ahead, after the file was written to */
+void sflash_reader_drop(sflash_reader * reader);
+/*
+  Returns 1 with the next card, its text valid until the next
+  call; 0 at the end of the file; -1 with `err` set on a syntax
+  or read error
+*/
+int sflash_reader_next(sflash_reader * reader, sflash_card * card,
+  sflash_error * err);
+
+/* Lines and answers */
+
+/* `*text` receives the offset of the text after the marker */
+sflash_line sflash_line_kind(const sflash_dialect * dialect,
+  const char * line, size_t len, size_t * text);
+sflash_kind sflash_answer_kind(const char * answer, size_t len);
+/* Whether a '\' before `c` is an escape */
+int sflash_escapable(char c);
+/* `dst` may be `src`; returns the unescaped length */
+size_t sflash_unescape(char * dst, const char * src, size_t len);
+/*
+  Splits an answer into unescaped words (SFLASH_TOKENS) or
+  items (SFLASH_LIST, SFLASH_SEQUENCE). `buf` must hold `len`
+  bytes; `items` receives up to `max_items` spans into it.
+
+  Returns: the number of items, which may exceed `max_items`
+*/
+size_t sflash_split(const sflash_dialect * dialect, sflash_kind kind,
+  const char * src, size_t len, char * buf, sflash_span * items,
+  size_t max_items);
+/* The same for what a user typed, where every '\' is literal */
+size_t sflash_split_input(const sflash_dialect * dialect, sflash_kind kind,
+  const char * src, size_t len, char * buf, sflash_span * items,
+  size_t max_items);
+
+/* Grading */
+
+typedef struct
+{
+  uint32_t matches;
+  uint32_t total;
+  double matched_weight;
+  double total_weight; /* 0 when unweighted */
+} sflash_grade;
+
+/* Score as shown to the user: weighted when weights were given */
+double sflash_grade_score(const sflash_grade * grade);
+
+/*
+  Every given word scores each real word it equals, weighted
+  by `weights[real index]` when `weights` is not NULL
+*/
+void sflash_grade_words(const sflash_span * real, const float * weights,
+  size_t n_real, const sflash_span * given, size_t n_given,
+  sflash_grade * grade);
+
+/* Index of the item equal to `given`, or -1 */
+long sflash_find_item(const sflash_span * items, size_t n,
+  const char * given, size_t len);
+
+typedef struct sflash_sequence sflash_sequence;
+
+/* Copies the items; NULL when out of memory */
+sflash_sequence * sflash_sequence_compile(const sflash_span * items, size_t n);
+void sflash_sequence_free(sflash_sequence * seq);
+/*
+  `grade->matches` is the longest common subsequence of the
+  given and the real items; `*present` counts the real items
+  given in any order
+*/
+void sflash_sequence_grade(const sflash_sequence * seq,
+  const sflash_span * given, size_t n, sflash_grade * grade,
+  uint32_t * present);
+
+/* Editing */
+
+/*
+  Rewrites the card whose first line starts at `offset`, in a
+  deck opened for update ("r+b"). The text is in deck syntax,
+  without marker or line end; NULL keeps the old text.
+
+  When both new lines fit in the old ones they are written in
+  place, padded with leading blanks. Otherwise the card is
+  appended to the end of the file and the old one tombstoned:
+  its markers start with '#', so readers skip its lines.
+
+  Returns: the card's offset now, or -1 with `err` set
+*/
+int64_t sflash_card_rewrite(FILE * file, uint64_t offset,
+  const char * question, size_t question_len,
+  const char * answer, size_t answer_len,
+  const sflash_dialect * dialect, sflash_error * err);
+
+/* Scanning */
+
+uint64_t sflash_count_byte(const char * src, size_t len, char c);
+/* Offset of the nth (1-based) `c`, or `len` when there are fewer */
+size_t sflash_find_nth_byte(const char * src, size_t len, char c, uint64_t n);
+
+/*
+  Offset tables: a growable, nondecreasing sequence of file
+  offsets (e.g. where each card starts), Elias-Fano coded in
+  blocks of 256, so a card costs about log2(average card
+  size) + 2 bits instead of 8 bytes. Access by index is O(1),
+  lookup by offset O(log n).
+*/
+
+/* NULL when out of memory */
+sflash_offsets * sflash_offsets_new(void);
+void sflash_offsets_free(sflash_offsets * table);
+/* Returns 0, leaving the table as it was, when out of memory
+   or `offset` is below the last one */
+int sflash_offsets_push(sflash_offsets * table, uint64_t offset);
+size_t sflash_offsets_count(const sflash_offsets * table);
+/* `index` must be below the count */
+uint64_t sflash_offsets_get(const sflash_offsets * table, size_t index);
+/*
+  Index of the last offset <= `offset`, or the count when
+  every offset is greater
+*/
+size_t sflash_offsets_find(const sflash_offsets * table, uint64_t offset);
+/* Memory held by the table */
+size_t sflash_offsets_bytes(const sflash_offsets * table);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -26,16 +26,34 @@
 
 #include <iostream>
 #include <vector>
+#include <array>
 #include <string>
 #include <utility>
 #include <deque>
 #include <list>
+#include <map>
+#include <set>
 #include <algorithm>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <functional>
+#include <stdexcept>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <time.h>
+#include <math.h>
+#include <ctype.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <termios.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+#include <signal.h>
+#include <sys/stat.h>
+#include "libsflash.h"
 
 using namespace std;
 
@@ -51,63 +69,210 @@ public:
       puts("File not found error");
       exit(1);
     }
-    line = NULL;
-    line = (char *) calloc(longest_line, 1);
-    if(!line)
-      puts("w0t m8");
-    line_count();
+    strPath = filename;
+    pEdit = NULL;
+    iLineCount = 0;
+    counted = false;
+    iLine = 0;
+    iRandomState = 0x9e3779b97f4a7c15ULL;
   }
   ~File()
   {
     fclose(pFile);
-    delete line;
+    if(pEdit)
+      fclose(pEdit);
   }
-  char * get_line()
+  void seed(uint64_t iSeed)
   {
-    char * ret = fgets(line, longest_line - 1, pFile);
-    return ret;
+    iRandomState = iSeed ? iSeed : 0x9e3779b97f4a7c15ULL;
   }
-  void set_random_pos_to_line()
+  uint64_t random_line()
+  /*
+    An even line, as cards are assumed to take two
+  */
   {
-    uint32_t iSkipTo = rand() % iLineCount;
+    if(!counted)
+      line_count();
+    if(!iLineCount)
+      return 0;
+    //xorshift64*, so the state fits in a checkpoint
+    iRandomState ^= iRandomState >> 12;
+    iRandomState ^= iRandomState << 25;
+    iRandomState ^= iRandomState >> 27;
+    uint64_t iSkipTo = (iRandomState * 0x2545f4914f6cdd1dULL) % iLineCount;
     iSkipTo /= 2;
     iSkipTo *= 2;
-    
-    fseek(pFile, 0, SEEK_SET);
-    char c = 0;
-    uint64_t iThisLine = 0;
-    while((c = fgetc(pFile)) != EOF
-      && iThisLine < iSkipTo)
-    {
-      if(c == '\n')
-        iThisLine += 1;
-    }
-    ungetc(c, pFile);
+    return iSkipTo;
+  }
+  long line_mark(uint64_t iLine_, uint64_t * piMarkLine)
+  /*
+    The nearest mark line_count() left at or before line
+    `iLine_`, so at most kiLineMark lines lie in between
+  */
+  {
+    if(!counted)
+      line_count();
+    size_t iMark = min((size_t) (iLine_ / kiLineMark), vecLineMarks.size() - 1);
+    *piMarkLine = iMark * kiLineMark;
+    return vecLineMarks[iMark];
+  }
+  uint64_t line_at(long iOffset)
+  /*
+    The line starting at `iOffset`, counted on from the mark
+    before it; rewrite() leaves moved cards' lines to this
+  */
+  {
+    if(!counted)
+      line_count();
+    long iResume = ftell(pFile);
+    size_t iMark = upper_bound(begin(vecLineMarks), end(vecLineMarks),
+      iOffset) - begin(vecLineMarks) - 1;
+    uint64_t iLine_ = iMark * kiLineMark
+      + lines_between(vecLineMarks[iMark], iOffset);
+    fseek(pFile, iResume, SEEK_SET);
+    return iLine_;
   }
   void reset_position()
   {
     fseek(pFile, 0, SEEK_SET);
+    iLine = 0;
+  }
+  long tell()
+  {
+    return ftell(pFile);
+  }
+  void seek(long iPos)
+  {
+    fseek(pFile, iPos, SEEK_SET);
+  }
+  void seek(long iPos, uint64_t iLine_)
+  {
+    fseek(pFile, iPos, SEEK_SET);
+    iLine = iLine_;
+  }
+  uint64_t line_number()
+  {
+    return iLine;
+  }
+  size_t read(char * pDest, size_t iBytes)
+  {
+    return fread(pDest, 1, iBytes, pFile);
+  }
+  FILE * handle()
+  {
+    return pFile;
+  }
+  long rewrite(long iOffset, const string * pQuestion,
+    const string * pAnswer, const sflash_dialect * pDialect,
+    uint64_t * piLine)
+  /*
+    Edits the card at `iOffset`, on line `*piLine`, in the
+    deck itself, see sflash_card_rewrite(). A card moved to
+    the end only adds its own lines to the count and marks;
+    `*piLine` gets its new line, or kiUnknownLine when the
+    deck was never counted, see line_at(). Returns where the
+    card starts now, or -1
+  */
+  {
+    if(!pEdit && !(pEdit = fopen(strPath.c_str(), "r+b")))
+    {
+      cout << "Cannot write to " << strPath << "\n";
+      return -1;
+    }
+    long iResume = ftell(pFile);
+    fseek(pEdit, 0, SEEK_END);
+    long iOldEnd = ftell(pEdit);
+    sflash_error err;
+    int64_t iNew = sflash_card_rewrite(pEdit, iOffset,
+      pQuestion ? pQuestion->data() : NULL, pQuestion ? pQuestion->size() : 0,
+      pAnswer ? pAnswer->data() : NULL, pAnswer ? pAnswer->size() : 0,
+      pDialect, &err);
+    //the read buffer may still hold the old text
+    fflush(pFile);
+    if(iNew < 0)
+      cout << "Edit failed: " << err.message << "\n";
+    else if(iNew != iOffset)
+    {
+      if(counted)
+      {
+        count_from(iOldEnd);
+        *piLine = iLineCount - 2;
+      }
+      else
+        *piLine = kiUnknownLine; //not worth reading the deck for yet
+    }
+    fseek(pFile, iResume, SEEK_SET);
+    return iNew;
   }
+
+  static const size_t kiBlock = 1 << 20;
+  static const uint32_t kiLineMark = 4096;
+  static const uint64_t kiUnknownLine = ~(uint64_t) 0;
+
+  friend class Checkpoint;
 private:
-  char * line;
-  uint32_t iLineCount;
-  static const int longest_line = 512;
+  uint64_t iLineCount;
+  bool counted;
+  vector<long> vecLineMarks; //offset of every kiLineMark-th line
+  uint64_t iLine; //of the read position
+  uint64_t iRandomState;
   FILE * pFile;
+  FILE * pEdit; //opened for update on the first edit
+  string strPath;
 
   uint64_t line_count()
+  /*
+    Only needed to jump to random lines, so done on the first jump
+  */
   {
-    fseek(pFile, 0, SEEK_SET);
+    long iResume = ftell(pFile);
     iLineCount = 0;
-    char c = 0;
-    while((c = fgetc(pFile)) != EOF)
+    vecLineMarks.assign(1, 0);
+    count_from(0);
+    fseek(pFile, iResume, SEEK_SET);
+    counted = true;
+    return iLineCount;
+  }
+  uint64_t lines_between(long iFrom, long iTo)
+  /*
+    Newlines in [iFrom, iTo)
+  */
+  {
+    fseek(pFile, iFrom, SEEK_SET);
+    vector<char> buf(kiBlock);
+    uint64_t iLines = 0;
+    size_t iRead = 0;
+    while(iFrom < iTo && (iRead = fread(buf.data(), 1,
+      min(buf.size(), (size_t) (iTo - iFrom)), pFile)) > 0)
     {
-      if(c == '\n')
+      iLines += sflash_count_byte(buf.data(), iRead, '\n');
+      iFrom += iRead;
+    }
+    return iLines;
+  }
+  void count_from(long iOffset)
+  /*
+    Counts the lines and sets the marks from `iOffset`, where
+    line iLineCount starts, to the end
+  */
+  {
+    fseek(pFile, iOffset, SEEK_SET);
+    vector<char> buf(kiBlock);
+    size_t iRead = 0;
+    while((iRead = fread(buf.data(), 1, buf.size(), pFile)) > 0)
+    {
+      uint64_t iLines = sflash_count_byte(buf.data(), iRead, '\n');
+      //lines iLineCount + 1 .. iLineCount + iLines start in this block
+      uint64_t iNext = vecLineMarks.size() * kiLineMark;
+      while(iNext <= iLineCount + iLines)
       {
-        ++iLineCount;
+        vecLineMarks.push_back(iOffset + 1 + sflash_find_nth_byte(buf.data(),
+          iRead, '\n', iNext - iLineCount));
+        iNext += kiLineMark;
       }
+      iLineCount += iLines;
+      iOffset += iRead;
     }
-    fseek(pFile, 0, SEEK_SET);
-    return iLineCount;
   }
 
 };
@@ -116,36 +281,271 @@ struct QA
 {
   string question;
   string answer;
+  vector<float> vecWeights; //of each answer word, with --idf
+};
+
+namespace ProgramOptions
+{
+  static uint32_t options = 0x0;
+  static const uint32_t randomize = 0x01;
+  static const uint32_t perpetual = 0x02;
+  static const uint32_t idf = 0x04;
+  static const uint32_t live = 0x08;
+
+  static uint16_t kiCardsToLoad = 5;
+  static float fNoRepeatThreshold = 0.50f;
+  static float fDedupeThreshold = 0.80f;
+  static uint32_t iThreads = 0; //0 picks one per core
+  static uint32_t iCacheMB = 64; //parsed-card cache, 0 disables
+  static uint16_t iChoices = 0; //multiple choice when above 1
+
+  static const char * szDeck = NULL;
+  static const char * szHistory = NULL; //review log prefix
+  static const char * szCheckpoint = NULL;
+  static const sflash_dialect * pDialect = NULL; //the default one
+  static char ** take_dialect(char **);
+
+  static uint32_t iStatsTop = 20;
+  static uint32_t iStatsDays = 30; //0 covers the whole history
+  static uint32_t iStatsMinReviews = 2;
+
+  static bool import_header = false;
+  static bool import_quotes = false; //quoted TSV fields, always on for CSV
+  static uint16_t iImportQuestionColumn = 1;
+  static uint16_t iImportAnswerColumn = 2;
+}
+
+class CardCache
+/*
+  Parsed cards keyed by the file offset of their first line.
+  Card text lives in a fixed-size ring arena; when it fills,
+  the oldest entries are evicted CLOCK-style: an entry read
+  since it was last passed over is moved to the tail instead,
+  so frequently reviewed cards stay resident and memory use
+  never exceeds the budget.
+*/
+{
+public:
+  CardCache(size_t iBytes)
+    :arena(iBytes)
+  {
+    iTail = 0;
+    iFrontSeq = 0;
+  }
+  bool find(long, QA *, long *, long *, uint16_t *);
+  void insert(long, long, long, uint16_t, const QA&);
+  void erase(long);
+private:
+  struct Entry
+  {
+    long iOffset;
+    long iEnd;
+    long iCard; //where the question line starts
+    size_t iPos;
+    uint32_t iQuestionLen;
+    uint32_t iAnswerLen;
+    uint32_t iWeights;
+    uint16_t iLines;
+    bool referenced;
+  };
+  vector<char> arena;
+  size_t iTail;
+  deque<Entry> dequeEntries; //allocation order, front is oldest
+  uint64_t iFrontSeq;
+  unordered_map<long, uint64_t> mapIndex; //offset -> sequence number
+
+  bool allocate(size_t, size_t *);
 };
 
+class TermWeights;
+
 class Parser
+/*
+  Steps through the deck with a libsflash reader; syntax
+  errors are thrown as runtime_error
+*/
 {
   friend class Prompt;
 public:
   Parser(File * file_)
+    :cache((size_t) ProgramOptions::iCacheMB << 20)
   {
     file = file_;
     used = false;
+    at_end = false;
+    pWeights = NULL;
+    pReader = sflash_reader_open(file->handle(), ProgramOptions::pDialect);
+    if(!pReader)
+    {
+      puts("Out of memory");
+      exit(1);
+    }
+  }
+  ~Parser()
+  {
+    sflash_reader_close(pReader);
   }
 
   void split_QAs();
-  uint32_t iLinesRead;
+  void seek_line(uint64_t);
+  void read_deck(vector<QA>&);
+  void scan_deck(const function<void(const sflash_card&)>&);
+  void card_at(uint64_t, QA&);
+  void forget();
+  static string unescape(const string&);
+  static runtime_error deck_error(const sflash_error&);
+  bool at_end; //the last split_QAs() reached the end of the deck
+  const TermWeights * pWeights; //weighs each card as it is parsed
+
+  struct CardPos
+  {
+    long iOffset;
+    uint64_t iLine;
+    long iCard; //where the question line starts, past blank lines
+  };
 private:
   File * file;
+  sflash_reader * pReader;
   bool used;
   vector<QA> vQAs;
+  vector<CardPos> vecPositions; //where each card in vQAs starts
+  CardCache cache;
 };
 
 struct MatchResults
 {
   uint16_t iMatches;
   uint16_t iTotalWords;
+  float fMatchedWeight;
+  float fTotalWeight; //0 when the answer is unweighted
   float percentage()
   {
+    if(fTotalWeight > 0.0f)
+      return fMatchedWeight/fTotalWeight;
     return (float)iMatches/(float)iTotalWords;
   }
 };
 
+class TermWeights
+{
+public:
+  TermWeights()
+  {
+    fUnseen = 1.0f;
+  }
+  void build(Parser&);
+  float weight(const string&) const;
+  void weigh(QA&) const;
+private:
+  unordered_map<string, float> mapIDF;
+  float fUnseen;
+};
+
+class ReviewLog
+/*
+  Review outcomes stored column-wise: {prefix}.card64, .deck,
+  .time and .score each hold one fixed-width value per review,
+  so reports read and scan only the columns they need.
+  {prefix}.decks names the deck ids. Histories from before card
+  ids took 64 bits have a 32-bit .card column instead.
+*/
+{
+public:
+  ReviewLog()
+  {
+    used = false;
+  }
+  ~ReviewLog();
+  void open(const char *, const char *);
+  void record(const QA&, float);
+  static uint64_t card_id(const string&, bool legacy = false);
+  static uint32_t deck_id(const char *);
+private:
+  bool used;
+  uint32_t iDeck;
+  FILE * pCard;
+  FILE * pDeck;
+  FILE * pTime;
+  FILE * pScore;
+
+  static FILE * open_column(const string&, const char *);
+  static void widen_cards(const string&);
+};
+
+class Checkpoint
+/*
+  Session state kept in a small binary file so a run resumes
+  where it stopped: the card being asked, the random generator,
+  a bitmap of the cards seen this pass, by where their question
+  lines start, and, for a list, the items already given. The line
+  marks of the deck are stored too, so resuming scans nothing.
+  The file is replaced atomically at exit and on SIGINT; the
+  handler only writes an image built earlier, which is safe to do
+  from a signal handler. Images are built at the start of each
+  batch and otherwise at most every kiBuildSeconds; in between
+  only the card position is patched into them, so the seen cards
+  and list items may be a few seconds behind.
+*/
+{
+public:
+  Checkpoint()
+  {
+    used = false;
+    pFile = NULL;
+    iActive = 0;
+    iListOffset = -1;
+    iBuilt = 0;
+    posCurrent.iOffset = 0;
+    posCurrent.iLine = 0;
+    posCurrent.iCard = 0;
+  }
+  ~Checkpoint();
+  void open(const char *, File *);
+  bool resume();
+  void at(const Parser::CardPos&, bool batch = false);
+  void list_progress(const vector<uint32_t>&);
+  const vector<uint32_t>& list_progress() const
+  {
+    return vecList;
+  }
+  void mark_seen(long);
+  bool seen(long) const;
+  void clear_seen();
+  void deck_changed();
+  void finish();
+private:
+  bool used;
+  bool loaded;
+  string strPath;
+  string strTemp;
+  File * pFile;
+  uint64_t iDeckSize;
+  int64_t iDeckTime;
+  Parser::CardPos posCurrent;
+  vector<uint64_t> vecSeen; //bit per kiSeenGrain bytes of deck
+  uint64_t iSeen;
+  long iListOffset; //card vecList belongs to
+  vector<uint32_t> vecList;
+
+  vector<char> vecImages[2];
+  volatile sig_atomic_t iActive;
+  time_t iBuilt;
+
+  static const uint32_t kiVersion = 2;
+  //no card is shorter than "-\n+\n", so none share a bit
+  static const uint32_t kiSeenGrain = 4;
+  static const time_t kiBuildSeconds = 2;
+  static const size_t kiPositionAt = 24; //past magic, version and deck stamp
+  static Checkpoint * pInstance;
+
+  bool load();
+  void build();
+  void build_due();
+  void patch_position();
+  static bool write_image(const char *, const char *, const vector<char>&);
+  static void on_interrupt(int);
+};
+
 class Prompt;
 
 typedef void (Prompt::*fnDecision)(QA *);
@@ -153,23 +553,133 @@ typedef void (Prompt::*fnDecision)(QA *);
 class AnswerHandler
 {
   friend class Prompt;
+  friend class TermWeights;
+  friend class PrefixIndex;
 public:
   AnswerHandler()
   {
     used = false;
+    pSequence = NULL;
+  }
+  ~AnswerHandler()
+  {
+    sflash_sequence_free(pSequence);
   }
-  void exec(const string&, fnDecision *);
+  void exec(const QA&, fnDecision *);
 private:
   bool used;
   string strAnswer;
 
-  static void load_words(list<string>&, const string&);
+  static void split(sflash_kind, const string&, vector<string>&,
+    bool typed = false);
+  static void load_words(list<string>&, const string&, bool typed = false);
   MatchResults compare_words(const list<string>&);
   list<string> lstWords;
+  vector<float> vecWeights;
+  struct WordMatch
+  {
+    uint16_t iCount;
+    float fWeight;
+  };
+  unordered_map<string, WordMatch> mapWordMatches; //for --live
   
   void construct_list();
   vector<string> vecListItems;
 
+  void construct_sequence();
+  static void split_sequence(const string&, vector<string>&,
+    bool typed = false);
+  MatchResults compare_sequence(const vector<string>&, uint16_t *);
+  vector<string> vecSequenceItems;
+  sflash_sequence * pSequence;
+
+};
+
+class PrefixIndex
+/*
+  Every distinct answer word and list item in the deck, sorted
+  and front-coded in blocks of kiBlock: each block starts with
+  a whole string, the rest store only the length shared with
+  their predecessor and the remaining suffix. Lookups binary
+  search the block heads, then decode at most one block.
+  Each word counts the times it occurs, so cards edited in a
+  session can take their words out and put new ones in; words
+  down to 0 are skipped and new words kept on the side.
+*/
+{
+public:
+  PrefixIndex()
+  {
+    iSize = 0;
+    built = false;
+  }
+  void build(vector<string>&);
+  void add(const string&);
+  void remove(const string&);
+  size_t count(const string&) const;
+  void complete(const string&, size_t, vector<string>&) const;
+  bool ready() const
+  {
+    return built;
+  }
+private:
+  static const size_t kiBlock = 16;
+  string strPool;
+  vector<uint32_t> vecBlocks; //pool offset of each block
+  vector<uint32_t> vecUses; //occurrences of each word
+  size_t iSize;
+  bool built;
+  set<size_t> setGone; //words no longer used
+  map<string, uint32_t> mapAdded; //words the deck did not have, and uses
+
+  size_t lower_bound(const string&) const;
+  bool find(const string&, size_t *) const;
+  static void put_varint(string&, uint32_t);
+  static uint32_t get_varint(const char *&);
+};
+
+class AnswerIndex
+/*
+  Finds answers resembling a given one, to serve as distractors
+  in multiple choice. Each answer's MinHash signature is cut into
+  kiBands bands of kiRows hashes; a band's hash and the card
+  number share one sorted 64-bit entry per band. A lookup binary
+  searches the query's bucket in each band and ranks what it
+  finds by the number of bands shared, so nothing is compared
+  pairwise and the cost does not grow with the deck. Only where
+  each card starts is kept; the answers picked are read back.
+*/
+{
+public:
+  AnswerIndex()
+  {
+    pFile = NULL;
+    pReader = NULL;
+    pOffsets = NULL;
+  }
+  ~AnswerIndex()
+  {
+    sflash_reader_close(pReader);
+    sflash_offsets_free(pOffsets);
+    if(pFile)
+      fclose(pFile);
+  }
+  void build(Parser&);
+  void update(uint64_t, uint64_t, const string&, const string&);
+  void similar(const string&, size_t, vector<string>&);
+  static string plain(const char *, size_t);
+private:
+  static const uint16_t kiBands = 8;
+  static const uint16_t kiRows = 2;
+  static const size_t kiBucketScan = 32; //entries read per bucket
+  FILE * pFile; //a handle of its own, so sessions are not moved
+  sflash_reader * pReader;
+  sflash_offsets * pOffsets; //where each card starts
+  set<uint32_t> setMoved; //cards edited to the end, under a new number
+  vector<uint64_t> vecBands[kiBands]; //band hash << 32 | card
+
+  static void band_keys(const string&, uint32_t *);
+  string answer(uint32_t);
 };
 
 class Prompt
@@ -180,357 +690,1330 @@ public:
     :ah(), parser(pFile)
   {
     fnWhich = NULL;
+    edited = false;
+    if(ProgramOptions::options & ProgramOptions::idf)
+    {
+      weights.build(parser);
+      parser.pWeights = &weights;
+    }
+    if(ProgramOptions::szHistory)
+    {
+      log.open(ProgramOptions::szHistory, ProgramOptions::szDeck);
+    }
+    if(ProgramOptions::szCheckpoint)
+    {
+      checkpoint.open(ProgramOptions::szCheckpoint, pFile);
+    }
+    if(ProgramOptions::iChoices > 1)
+    {
+      answers.build(parser);
+    }
   }
   void loop();
   uint32_t lines_read;
 private:
   AnswerHandler ah;
   Parser parser;
+  TermWeights weights;
+  ReviewLog log;
+  Checkpoint checkpoint;
+  PrefixIndex hints;
+  AnswerIndex answers;
   fnDecision fnWhich;
+  Parser::CardPos posCurrent;
+  bool edited; //the card changed while being asked
   void tokens(QA *);
   void list(QA *);
+  void sequence(QA *);
+  void choice(QA *);
+  void read_live(string&);
+  bool hint(const string&, const vector<string>&, uint16_t *);
+  static void hint_words(const string&, vector<string>&);
+  bool edit(const string&, QA *);
 };
 
-namespace ProgramOptions
+class RawTerminal
+/*
+  Puts stdin in non-canonical, no-echo mode for as long as
+  it lives. active() is false when stdin is not a terminal.
+*/
 {
-  static uint32_t options = 0x0;
-  static const uint32_t randomize = 0x01;
-  static const uint32_t perpetual = 0x02;
-
-  static uint16_t kiLinesToLoad = 10;
-  static float fNoRepeatThreshold = 0.50f;
-}
+public:
+  RawTerminal()
+  {
+    raw = false;
+#if defined(__unix__) || defined(__APPLE__)
+    if(!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &saved))
+      return;
+    struct termios t = saved;
+    t.c_lflag &= ~(ICANON | ECHO | ISIG);
+    t.c_cc[VMIN] = 1;
+    t.c_cc[VTIME] = 0;
+    raw = !tcsetattr(STDIN_FILENO, TCSAFLUSH, &t);
+#endif
+  }
+  ~RawTerminal()
+  {
+    restore();
+  }
+  void restore()
+  {
+#if defined(__unix__) || defined(__APPLE__)
+    if(raw)
+      tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved);
+#endif
+    raw = false;
+  }
+  bool active()
+  {
+    return raw;
+  }
+  int get()
+  {
+    unsigned char c = 0;
+#if defined(__unix__) || defined(__APPLE__)
+    if(::read(STDIN_FILENO, &c, 1) != 1)
+      return EOF;
+#endif
+    return c;
+  }
+private:
+  bool raw;
+#if defined(__unix__) || defined(__APPLE__)
+  struct termios saved;
+#endif
+};
 
-int main(int argc, char ** argv)
+class Deduper
 {
-  char ** pArgv = argv;
-  ++pArgv;
-
-  File my_file(*(pArgv++), "r");
-  srand(time(NULL));
-  
-  while(*pArgv != NULL)
+public:
+  Deduper(File * pFile)
+    :parser(pFile)
   {
-    if(!strcmp(*pArgv, "--randomize") ||
-      !strcmp(*pArgv, "--r"))
-    {
-      ProgramOptions::options |= ProgramOptions::randomize;
-    }
-    else if(!strcmp(*pArgv, "--perpetual") ||
-      !strcmp(*pArgv, "-p"))
+    iCards = 0;
+    pOffsets = sflash_offsets_new();
+    if(!pOffsets)
     {
-      ProgramOptions::options |= ProgramOptions::perpetual;
+      puts("Out of memory");
+      exit(1);
     }
-    else if(!strcmp(*pArgv, "--no-repeat-threshold") ||
-      !strcmp(*pArgv, "-t"))
+  }
+  ~Deduper()
+  {
+    sflash_offsets_free(pOffsets);
+  }
+  void report();
+
+  static const uint16_t kiHashes = 64;
+  static void signature(const string&, uint32_t *, uint16_t = kiHashes);
+private:
+  Parser parser;
+  size_t iCards;
+  sflash_offsets * pOffsets; //where each card starts, for the report
+  vector<uint32_t> vSignatures;
+  vector<uint32_t> vParents;
+
+  //buckets up to this size compare every pair
+  static const size_t kiAllPairs = 64;
+  //larger ones compare each card with up to this many
+  static const size_t kiLeaders = 64;
+
+  void compute_signatures();
+  void sign_batch(const vector<string>&, size_t);
+  void find_candidates(uint16_t, uint16_t,
+    vector<pair<uint32_t, uint32_t>>&);
+  float similarity(uint32_t, uint32_t);
+  uint32_t find_root(uint32_t);
+};
+
+
+class Importer
+{
+public:
+  Importer(const char *, char);
+  void write(const char *);
+private:
+  vector<char> vecInput;
+  char cDelim;
+  char cListSep; //0 when the answer column is not list-valued
+  bool quoting;
+
+  //where a byte falls, for the quote rules
+  enum
+  {
+    kFieldStart, //a '"' here opens a quoted field
+    kUnquoted,
+    kQuoted,
+    kQuotedQuote, //a '"' in quotes: closes them, or "" is a quote
+    kStates
+  };
+  uint8_t step(uint8_t, char) const;
+  size_t record_start(size_t, uint8_t);
+  size_t parse_record(size_t, vector<string>&);
+  void detect_lists();
+  void format_records(size_t, size_t, string&, uint64_t *);
+
+  //what a field becomes, for what needs escaping in it
+  enum Field
+  {
+    kQuestion,
+    kAnswer,
+    kItem //of a {} list
+  };
+  static void escape(const string&, Field, string&);
+};
+
+class Stats
+{
+public:
+  Stats(const char *);
+  void report();
+private:
+  string strPrefix;
+  const char * szCards; //.card64, or .card in an old history
+  size_t iCardWidth;
+  size_t iRows;
+
+  FILE * open_column(const char *, size_t, size_t);
+};
+
+class Checker
+/*
+  Lint mode: validates a whole deck without running a session.
+  The file is cut into chunks at line boundaries and each chunk
+  is checked on its own core. Whether a chunk's first card line
+  is an error depends only on whether the previous chunk ended
+  with an open question, so that is settled afterwards, in order.
+*/
+{
+public:
+  Checker(const char *);
+  bool report();
+private:
+  struct Error
+  {
+    uint64_t iLine;
+    uint32_t iColumn;
+    const char * szMessage;
+    bool operator<(const Error& other) const
     {
-      if(*++pArgv == NULL)
-      {
-        puts("Invalid command line arguments."
-          "--no-repeat-threshold was not given an integer");
-        exit(1);
-      }
-      ProgramOptions::fNoRepeatThreshold = (float) atoi(*pArgv) / 100;
+      if(iLine != other.iLine)
+        return iLine < other.iLine;
+      if(iColumn != other.iColumn)
+        return iColumn < other.iColumn;
+      return strcmp(szMessage, other.szMessage) < 0;
     }
-    ++pArgv;
-  }
+  };
+  struct Chunk
+  {
+    uint64_t iLines;
+    uint64_t iCards;
+    vector<Error> vecErrors; //lines relative to the chunk
+    sflash_line first; //first card line, SFLASH_LINE_OTHER if none
+    Error errFirst;
+    bool open; //ends with a question still waiting for its answer
+    Error errOpen;
+  };
 
-  Prompt prompt(&my_file);
-  prompt.loop();
+  const char * szPath;
+  uint64_t iSize;
 
-  return 0;
-}
+  void check_chunk(uint64_t, uint64_t, Chunk&);
+  void check_line(const char *, size_t, Chunk&);
+  static void check_braces(const char *, size_t, size_t, uint64_t,
+    vector<Error>&);
+};
 
-void Parser::split_QAs()
+int main(int argc, char ** argv)
 {
-  string buf;
-  
-  uint8_t in_what = 0;
-  static const uint8_t in_question = 0x01;
-  static const uint8_t in_answer = 0x02;
-  static const uint8_t question_full = 0x04;
-  static const uint8_t answer_full = 0x08;
+  char ** pArgv = argv;
+  ++pArgv;
 
-  if(used)
+  if(*pArgv == NULL)
   {
-    vQAs.clear();
+    puts("Usage: sflash2 {file path} [options]");
+    exit(1);
   }
-  iLinesRead = 0;
 
-  char * test = NULL;
-  string strThisLine;
-  QA qaTemp;
-  
-  for(uint16_t i = 0; i < ProgramOptions::kiLinesToLoad; ++i)
+  if(!strcmp(*pArgv, "check"))
   {
-    if((test = file->get_line()) == NULL)
+    if(*++pArgv == NULL)
     {
-      vQAs.push_back(qaTemp);
-      break;
+      puts("Invalid command line arguments. check was not given a file");
+      exit(1);
     }
-    else
-      strThisLine.assign(test, strlen(test));
-
-    for(auto iter = begin(strThisLine);
-      iter != end(strThisLine); ++iter)
+    const char * szDeck = *(pArgv++);
+    while(*pArgv != NULL)
     {
-      switch(*iter)
+      if(!strcmp(*pArgv, "--threads") ||
+        !strcmp(*pArgv, "-j"))
       {
-        case '-':
-          in_what |= in_question;
-          break;
-        case '+':
-          in_what |= in_answer;
-          break;
-        default:
+        if(*++pArgv == NULL)
         {
-          buf.append(1, *iter);
-          break;
+          puts("Invalid command line arguments."
+            "--threads was not given an integer");
+          exit(1);
         }
+        ProgramOptions::iThreads = atoi(*pArgv);
       }
+      else if(!strcmp(*pArgv, "--dialect"))
+        pArgv = ProgramOptions::take_dialect(pArgv);
+      ++pArgv;
     }
+    Checker checker(szDeck);
+    return checker.report() ? 0 : 1;
+  }
 
-    if(in_what & question_full && in_what & answer_full)
+  if(!strcmp(*pArgv, "dedupe"))
+  {
+    if(*++pArgv == NULL)
     {
-      vQAs.push_back(qaTemp);
-      in_what ^= question_full;
-      in_what ^= answer_full;
-      qaTemp.question.clear();
-      qaTemp.answer.clear();
+      puts("Invalid command line arguments. dedupe was not given a file");
+      exit(1);
     }
-    if(in_what & in_question)
+    File deck(*(pArgv++), "r");
+    while(*pArgv != NULL)
     {
-      if(in_what & question_full)
+      if(!strcmp(*pArgv, "--threshold") ||
+        !strcmp(*pArgv, "-t"))
       {
-        cout << "Syntax error: unmatched question/answer pair\nAborting...\n";
-        exit(1); //TODO change to exception
+        if(*++pArgv == NULL)
+        {
+          puts("Invalid command line arguments."
+            "--threshold was not given an integer");
+          exit(1);
+        }
+        ProgramOptions::fDedupeThreshold = (float) atoi(*pArgv) / 100;
       }
-      qaTemp.question.assign(buf);
-      in_what ^= in_question;
-      in_what |= question_full;
-    }
-    else if(in_what & in_answer)
-    {
-      if(in_what & answer_full)
+      else if(!strcmp(*pArgv, "--threads") ||
+        !strcmp(*pArgv, "-j"))
       {
-        cout << "Syntax error: unmatched question/answer pair\nAborting...\n";
-        exit(1); //TODO change to exception
+        if(*++pArgv == NULL)
+        {
+          puts("Invalid command line arguments."
+            "--threads was not given an integer");
+          exit(1);
+        }
+        ProgramOptions::iThreads = atoi(*pArgv);
       }
-      qaTemp.answer.assign(buf);
-      in_what ^= in_answer;
-      in_what |= answer_full;
+      else if(!strcmp(*pArgv, "--dialect"))
+        pArgv = ProgramOptions::take_dialect(pArgv);
+      ++pArgv;
+    }
+    try
+    {
+      Deduper dedupe(&deck);
+      dedupe.report();
+    }
+    catch(const runtime_error& e)
+    {
+      cout << e.what() << "\nAborting...\n";
+      return 1;
     }
-    buf.clear();
-    iLinesRead += 1;
+    return 0;
   }
 
-  used = true;
-
-  vQAs.push_back(qaTemp);
-}
-
-void AnswerHandler::load_words
-(
-  list<string>& lstWords,
-  const string& strAnswer
-)
-{
-  string buf;
-  for(auto ch = begin(strAnswer);
-    ch != end(strAnswer); ++ch)
+  if(!strcmp(*pArgv, "import"))
   {
-    if(*ch == ' ')
+    char cDelim = 0;
+    const char * szIn = NULL;
+    const char * szOut = NULL;
+    while(*++pArgv != NULL)
     {
-      lstWords.push_back(buf);
-      buf.clear();
-      continue;
+      if(!strcmp(*pArgv, "--from"))
+      {
+        if(*++pArgv == NULL)
+        {
+          puts("Invalid command line arguments. --from was not given a format");
+          exit(1);
+        }
+        if(!strcmp(*pArgv, "tsv"))
+          cDelim = '\t';
+        else if(!strcmp(*pArgv, "csv"))
+          cDelim = ',';
+        else
+        {
+          puts("Invalid command line arguments. --from takes tsv or csv");
+          exit(1);
+        }
+      }
+      else if(!strcmp(*pArgv, "--header"))
+      {
+        ProgramOptions::import_header = true;
+      }
+      else if(!strcmp(*pArgv, "--quotes"))
+      {
+        ProgramOptions::import_quotes = true;
+      }
+      else if(!strcmp(*pArgv, "--question") ||
+        !strcmp(*pArgv, "--answer"))
+      {
+        bool question = !strcmp(*pArgv, "--question");
+        if(*++pArgv == NULL || atoi(*pArgv) < 1)
+        {
+          puts("Invalid command line arguments."
+            "--question/--answer was not given a column number");
+          exit(1);
+        }
+        if(question)
+          ProgramOptions::iImportQuestionColumn = atoi(*pArgv);
+        else
+          ProgramOptions::iImportAnswerColumn = atoi(*pArgv);
+      }
+      else if(!strcmp(*pArgv, "--threads") ||
+        !strcmp(*pArgv, "-j"))
+      {
+        if(*++pArgv == NULL)
+        {
+          puts("Invalid command line arguments."
+            "--threads was not given an integer");
+          exit(1);
+        }
+        ProgramOptions::iThreads = atoi(*pArgv);
+      }
+      else if(!szIn)
+        szIn = *pArgv;
+      else
+        szOut = *pArgv;
     }
-    if(*ch == '\n')
-      break;
-    buf.append(1, *ch);
+    if(!cDelim || !szIn || !szOut)
+    {
+      puts("Usage: sflash2 import --from tsv|csv {input} {output deck}");
+      exit(1);
+    }
+    Importer importer(szIn, cDelim);
+    importer.write(szOut);
+    return 0;
   }
-  lstWords.push_back(buf);
-}
 
-MatchResults AnswerHandler::compare_words
-(
-  const list<string>& lstWordsAgainst
-)
-{
-  MatchResults ret;
-  ret.iMatches = 0;
-
-  for(auto real = begin(lstWords);
-    real != end(lstWords); ++real)
+  if(!strcmp(*pArgv, "stats"))
   {
-    for(auto given = begin(lstWordsAgainst);
-      given != end(lstWordsAgainst); ++given)
+    if(*++pArgv == NULL)
+    {
+      puts("Usage: sflash2 stats {history prefix} [--deck file] [--top n]"
+        " [--days n] [--min-reviews n] [-t percent]");
+      exit(1);
+    }
+    const char * szPrefix = *pArgv;
+    while(*++pArgv != NULL)
     {
-      if(!real->compare(*given))
+      uint32_t * piDest = NULL;
+      if(!strcmp(*pArgv, "--deck"))
+      {
+        if(*++pArgv == NULL)
+        {
+          puts("Invalid command line arguments. --deck was not given a file");
+          exit(1);
+        }
+        ProgramOptions::szDeck = *pArgv;
+        continue;
+      }
+      else if(!strcmp(*pArgv, "--top"))
+        piDest = &ProgramOptions::iStatsTop;
+      else if(!strcmp(*pArgv, "--days"))
+        piDest = &ProgramOptions::iStatsDays;
+      else if(!strcmp(*pArgv, "--min-reviews"))
+        piDest = &ProgramOptions::iStatsMinReviews;
+      else if(!strcmp(*pArgv, "--threads") || !strcmp(*pArgv, "-j"))
+        piDest = &ProgramOptions::iThreads;
+      else if(!strcmp(*pArgv, "--no-repeat-threshold") || !strcmp(*pArgv, "-t"))
+      {
+        if(*++pArgv == NULL)
+        {
+          puts("Invalid command line arguments."
+            "--no-repeat-threshold was not given an integer");
+          exit(1);
+        }
+        ProgramOptions::fNoRepeatThreshold = (float) atoi(*pArgv) / 100;
+        continue;
+      }
+      else if(!strcmp(*pArgv, "--dialect"))
+      {
+        pArgv = ProgramOptions::take_dialect(pArgv);
+        continue;
+      }
+      else
+        continue;
+      if(*++pArgv == NULL)
       {
-        ret.iMatches += 1;
+        puts("Invalid command line arguments. An option was not given an integer");
+        exit(1);
       }
+      *piDest = atoi(*pArgv);
+    }
+    try
+    {
+      Stats stats(szPrefix);
+      stats.report();
     }
+    catch(const runtime_error& e)
+    {
+      cout << e.what() << "\nAborting...\n";
+      return 1;
+    }
+    return 0;
   }
 
-  ret.iTotalWords = lstWords.size();
-
-  return ret;
-}
-
-void AnswerHandler::construct_list()
-{
-  string buf;
-
-  if(used)
-    vecListItems.clear();
-
-  static const uint8_t in_item = 0x01;
-  uint8_t status = 0x0;
-
-  for(auto ch = begin(strAnswer);
-    ch != end(strAnswer); ++ch)
+  ProgramOptions::szDeck = *pArgv;
+  File my_file(*(pArgv++), "r");
+  srand(time(NULL));
+  my_file.seed(time(NULL));
+  
+  while(*pArgv != NULL)
   {
-    switch(*ch)
+    if(!strcmp(*pArgv, "--randomize") ||
+      !strcmp(*pArgv, "--r"))
     {
-    case '{':
-      break;
-    case ' ':
+      ProgramOptions::options |= ProgramOptions::randomize;
+    }
+    else if(!strcmp(*pArgv, "--perpetual") ||
+      !strcmp(*pArgv, "-p"))
+    {
+      ProgramOptions::options |= ProgramOptions::perpetual;
+    }
+    else if(!strcmp(*pArgv, "--idf") ||
+      !strcmp(*pArgv, "-w"))
+    {
+      ProgramOptions::options |= ProgramOptions::idf;
+    }
+    else if(!strcmp(*pArgv, "--live") ||
+      !strcmp(*pArgv, "-l"))
+    {
+      ProgramOptions::options |= ProgramOptions::live;
+    }
+    else if(!strcmp(*pArgv, "--no-repeat-threshold") ||
+      !strcmp(*pArgv, "-t"))
     {
-      if(status & in_item)
+      if(*++pArgv == NULL)
       {
-        goto add_character;
+        puts("Invalid command line arguments."
+          "--no-repeat-threshold was not given an integer");
+        exit(1);
       }
-      break;
+      ProgramOptions::fNoRepeatThreshold = (float) atoi(*pArgv) / 100;
     }
-    case ',':
+    else if(!strcmp(*pArgv, "--cache-mb"))
     {
-commit:
-      vecListItems.push_back(buf);
-      buf.clear();
-      status ^= in_item;
-
-      break;
+      if(*++pArgv == NULL)
+      {
+        puts("Invalid command line arguments."
+          "--cache-mb was not given an integer");
+        exit(1);
+      }
+      ProgramOptions::iCacheMB = atoi(*pArgv);
     }
-    case '}':
+    else if(!strcmp(*pArgv, "--history"))
     {
-      status ^= in_item;
-      goto commit;
+      if(*++pArgv == NULL)
+      {
+        puts("Invalid command line arguments."
+          "--history was not given a path");
+        exit(1);
+      }
+      ProgramOptions::szHistory = *pArgv;
     }
-    default:
+    else if(!strcmp(*pArgv, "--choices") ||
+      !strcmp(*pArgv, "-c"))
     {
-      status |= in_item;
-add_character:
-      buf.append(1, *ch);
-      break;
+      if(*++pArgv == NULL)
+      {
+        puts("Invalid command line arguments."
+          "--choices was not given an integer");
+        exit(1);
+      }
+      ProgramOptions::iChoices = atoi(*pArgv);
     }
+    else if(!strcmp(*pArgv, "--checkpoint"))
+    {
+      if(*++pArgv == NULL)
+      {
+        puts("Invalid command line arguments."
+          "--checkpoint was not given a path");
+        exit(1);
+      }
+      ProgramOptions::szCheckpoint = *pArgv;
     }
+    else if(!strcmp(*pArgv, "--dialect"))
+      pArgv = ProgramOptions::take_dialect(pArgv);
+    ++pArgv;
   }
-  used = true;
+
+  try
+  {
+    Prompt prompt(&my_file);
+    prompt.loop();
+  }
+  catch(const runtime_error& e)
+  {
+    cout << e.what() << "\nAborting...\n";
+    return 1;
+  }
+
+  return 0;
 }
 
-void AnswerHandler::exec
+char ** ProgramOptions::take_dialect
 (
-  const string& strUserAnswer,
-  fnDecision * fnWhich
+  char ** pArgv
 )
+/*
+  `pArgv` is at "--dialect": sets pDialect from the name after
+  it and returns where that name is, as every command takes it
+*/
+{
+  if(*++pArgv == NULL
+    || !(pDialect = sflash_dialect_find(*pArgv)))
+  {
+    puts("Invalid command line arguments."
+      "--dialect takes default, qa, semicolon or qa-semicolon");
+    exit(1);
+  }
+  return pArgv;
+}
+
+void Parser::split_QAs()
+/*
+  Loads the next kiCardsToLoad cards from where the file is,
+  taking the ones parsed before from the cache
+*/
 {
-  strAnswer = strUserAnswer;
+  if(used)
+  {
+    vQAs.clear();
+    vecPositions.clear();
+  }
+  used = true;
+  at_end = false;
+
+  //a no-op unless the file was moved since the last batch
+  sflash_reader_seek(pReader, file->tell(), file->line_number() + 1, 1);
 
-  for(auto ch = begin(strAnswer);
-    ch != end(strAnswer); ++ch)
+  sflash_card card;
+  sflash_error err;
+  QA qaTemp;
+  long iEnd = 0;
+  long iCard = 0;
+  uint16_t iLines = 0;
+  for(uint16_t i = 0; i < ProgramOptions::kiCardsToLoad; ++i)
   {
-    if(*ch == ' ')
+    uint64_t iLine = 0;
+    long iStart = sflash_reader_tell(pReader, &iLine);
+    if(cache.find(iStart, &qaTemp, &iEnd, &iCard, &iLines))
+    {
+      vQAs.push_back(qaTemp);
+      vecPositions.push_back(CardPos{iStart, iLine - 1, iCard});
+      sflash_reader_seek(pReader, iEnd, iLine + iLines, 0);
       continue;
-    if(*ch == '{')
+    }
+
+    int found = sflash_reader_next(pReader, &card, &err);
+    if(found < 0)
+      throw deck_error(err);
+    if(!found)
     {
-      construct_list();
-      *fnWhich = &Prompt::list;
+      at_end = true;
       break;
     }
-    load_words(lstWords, strAnswer);
-    *fnWhich = &Prompt::tokens;
-    break;
+    //kept with a line end, as typed answers are
+    qaTemp.question.assign(unescape(string(card.question, card.question_len)));
+    qaTemp.question.append(1, '\n');
+    qaTemp.answer.assign(card.answer, card.answer_len);
+    qaTemp.answer.append(1, '\n');
+    if(pWeights)
+      pWeights->weigh(qaTemp);
+    vQAs.push_back(qaTemp);
+    vecPositions.push_back(CardPos{iStart, iLine - 1, (long) card.offset});
+
+    uint64_t iEndLine = 0;
+    iEnd = sflash_reader_tell(pReader, &iEndLine);
+    cache.insert(iStart, iEnd, card.offset, iEndLine - iLine, qaTemp);
   }
+
+  uint64_t iLine = 0;
+  long iPos = sflash_reader_tell(pReader, &iLine);
+  file->seek(iPos, iLine - 1);
 }
 
-void Prompt::loop()
+bool CardCache::find
+(
+  long iOffset,
+  QA * pDest,
+  long * piEnd,
+  long * piCard,
+  uint16_t * piLines
+)
 {
-continue_looping:
-  do
+  auto found = mapIndex.find(iOffset);
+  if(found == end(mapIndex))
+    return false;
+  Entry& e = dequeEntries[found->second - iFrontSeq];
+  e.referenced = true;
+  pDest->question.assign(arena.data() + e.iPos, e.iQuestionLen);
+  pDest->answer.assign(arena.data() + e.iPos + e.iQuestionLen, e.iAnswerLen);
+  pDest->vecWeights.resize(e.iWeights);
+  memcpy(pDest->vecWeights.data(), arena.data() + e.iPos + e.iQuestionLen
+    + e.iAnswerLen, e.iWeights * sizeof(float));
+  *piEnd = e.iEnd;
+  *piCard = e.iCard;
+  *piLines = e.iLines;
+  return true;
+}
+
+bool CardCache::allocate
+(
+  size_t iBytes,
+  size_t * piPos
+)
+/*
+  Finds room for `iBytes` after the newest entry,
+  wrapping to the start of the arena when needed
+*/
+{
+  if(dequeEntries.empty())
+  {
+    *piPos = 0;
+    return iBytes <= arena.size();
+  }
+  size_t iHead = dequeEntries.front().iPos;
+  if(iTail > iHead)
   {
-    if(ProgramOptions::options & ProgramOptions::randomize)
+    if(iTail + iBytes <= arena.size())
     {
-      parser.file->set_random_pos_to_line();
+      *piPos = iTail;
+      return true;
     }
-    parser.split_QAs();
-    for(auto qa = begin(parser.vQAs);
-      qa != end(parser.vQAs); ++qa)
+    if(iBytes <= iHead)
     {
-      ah.exec(qa->answer, &fnWhich);
-      (this->*fnWhich)(&*qa);
+      *piPos = 0;
+      return true;
     }
-  } while(parser.iLinesRead == ProgramOptions::kiLinesToLoad);
-  
-  if(ProgramOptions::options & ProgramOptions::perpetual)
+    return false;
+  }
+  if(iTail + iBytes <= iHead)
   {
-    parser.file->reset_position();
-    goto continue_looping;
+    *piPos = iTail;
+    return true;
   }
+  return false;
 }
 
-void Prompt::tokens
+void CardCache::insert
 (
-  QA * qa
+  long iOffset,
+  long iEnd,
+  long iCard,
+  uint16_t iLines,
+  const QA& qa
 )
+/*
+  Evicts from the oldest end until the card fits. An evicted
+  entry that was read since it was last passed over gets a
+  second chance: it is queued to be written back at the tail.
+  A card's weights are kept after its text.
+*/
 {
-  cout << "Q: " << qa->question << "\n"
-    << "> ";
-  string strUserAnswer;
-  MatchResults res;
-  std::list<string> lstUserAnswer;
+  auto bytes = [](const QA& text)
+  {
+    return text.question.size() + text.answer.size()
+      + text.vecWeights.size() * sizeof(float);
+  };
+  size_t iSize = bytes(qa);
+  if(!iSize || iSize > arena.size() / 4
+    || mapIndex.find(iOffset) != end(mapIndex))
+  {
+    return;
+  }
 
-attempt:
-  getline(cin, strUserAnswer);
-  AnswerHandler::load_words(lstUserAnswer, strUserAnswer);
+  deque<pair<Entry, QA>> dequePending;
+  Entry e;
+  e.iOffset = iOffset;
+  e.iEnd = iEnd;
+  e.iCard = iCard;
+  e.iLines = iLines;
+  dequePending.push_back(make_pair(e, qa));
 
-  //TODO a punctuation filter
-  //TODO a word filter removing "the"s
+  while(!dequePending.empty())
+  {
+    Entry& entry = dequePending.front().first;
+    QA& text = dequePending.front().second;
+    size_t iBytes = bytes(text);
+    size_t iPos = 0;
 
-  res = ah.compare_words(lstUserAnswer);
+    while(!allocate(iBytes, &iPos))
+    {
+      Entry old = dequeEntries.front();
+      dequeEntries.pop_front();
+      ++iFrontSeq;
+      mapIndex.erase(old.iOffset);
+      if(old.referenced)
+      {
+        QA qaOld;
+        qaOld.question.assign(arena.data() + old.iPos, old.iQuestionLen);
+        qaOld.answer.assign(arena.data() + old.iPos + old.iQuestionLen, old.iAnswerLen);
+        qaOld.vecWeights.resize(old.iWeights);
+        memcpy(qaOld.vecWeights.data(), arena.data() + old.iPos
+          + old.iQuestionLen + old.iAnswerLen, old.iWeights * sizeof(float));
+        dequePending.push_back(make_pair(old, qaOld));
+      }
+      if(dequeEntries.empty())
+        iTail = 0;
+    }
 
-  cout << res.iMatches << "/" << res.iTotalWords <<
-    " == " << res.percentage() << "  " << qa->answer << "\n";
-  if(res.percentage() < ProgramOptions::fNoRepeatThreshold)
-  {
-    cout << "Try again.\n> ";
-    lstUserAnswer.clear();
-    strUserAnswer.clear();
-    goto attempt;
+    entry.iPos = iPos;
+    entry.iQuestionLen = text.question.size();
+    entry.iAnswerLen = text.answer.size();
+    entry.iWeights = text.vecWeights.size();
+    entry.referenced = false;
+    memcpy(arena.data() + iPos, text.question.data(), entry.iQuestionLen);
+    memcpy(arena.data() + iPos + entry.iQuestionLen, text.answer.data(), entry.iAnswerLen);
+    memcpy(arena.data() + iPos + entry.iQuestionLen + entry.iAnswerLen,
+      text.vecWeights.data(), entry.iWeights * sizeof(float));
+    iTail = iPos + iBytes;
+
+    mapIndex[entry.iOffset] = iFrontSeq + dequeEntries.size();
+    dequeEntries.push_back(entry);
+    dequePending.pop_front();
   }
-  ah.lstWords.clear(); //becuase this function controls when we're through with the real answer words
 }
 
-void Prompt::list
+void CardCache::erase
 (
-  QA * qa
+  long iOffset
 )
+/*
+  For a card edited in the deck. Its text stays in the arena
+  until the entry reaches the front, as a dead entry that is
+  never given a second chance.
+*/
 {
-  cout << "Q: " << qa->question << "\n"
-    << "> [list input]\n";
-  string strUserAnswer;
-  deque<vector<string>::iterator> dequePreviouslyCorrect;
+  auto found = mapIndex.find(iOffset);
+  if(found == end(mapIndex))
+    return;
+  Entry& e = dequeEntries[found->second - iFrontSeq];
+  e.iOffset = -1;
+  e.referenced = false;
+  mapIndex.erase(found);
+}
 
-  for(uint16_t successful_answers = 0;
-    successful_answers < ah.vecListItems.size(); ++successful_answers)
+string Parser::unescape
+(
+  const string& strSrc
+)
+/*
+  `\` before a syntax character makes it literal, so "\-"
+  and "\+" can appear in a card without starting a new one;
+  any other `\` stays
+*/
+{
+  string ret(strSrc);
+  ret.resize(sflash_unescape(&ret[0], ret.data(), ret.size()));
+  return ret;
+}
+
+void Parser::seek_line
+(
+  uint64_t iLine
+)
+/*
+  Moves to the question line of the first card at or after line
+  `iLine`, so tell() names the card: the lines from the nearest
+  mark on are skipped in the reader's buffer, which keeps them
+  for the batch that follows
+*/
+{
+  uint64_t iMarkLine = 0;
+  long iMark = file->line_mark(iLine, &iMarkLine);
+  sflash_error err;
+  sflash_card card;
+  sflash_reader_seek(pReader, iMark, iMarkLine + 1, 1);
+  if(sflash_reader_skip(pReader, iLine - iMarkLine, &err) < 0)
+    throw deck_error(err);
+  int found = sflash_reader_next(pReader, &card, &err);
+  if(found < 0)
+    throw deck_error(err);
+  if(found)
+    sflash_reader_seek(pReader, card.offset, card.line, 0);
+  uint64_t iAt = 0;
+  long iPos = sflash_reader_tell(pReader, &iAt);
+  file->seek(iPos, iAt - 1);
+}
+
+void Parser::read_deck
+(
+  vector<QA>& vDest
+)
+/*
+  Reads every question/answer pair in the file,
+  with the delimiters and line endings stripped
+*/
+{
+  QA qaTemp;
+  scan_deck([&](const sflash_card& card)
   {
-attempt:
-    cout << "  -> ";
-    getline(cin, strUserAnswer);
-    //escape hatches: "???" and "!!!"
-    if(strUserAnswer == "???")
-    {
-      for(auto i = begin(ah.vecListItems); i != end(ah.vecListItems);
+    qaTemp.question.assign(unescape(string(card.question, card.question_len)));
+    qaTemp.answer.assign(card.answer, card.answer_len);
+    vDest.push_back(qaTemp);
+  });
+}
+
+void Parser::card_at
+(
+  uint64_t iOffset,
+  QA& qa
+)
+/*
+  The card whose question line starts at `iOffset`, as
+  read_deck() gives it. The next split_QAs() goes on from
+  where the file is, as before.
+*/
+{
+  sflash_card card;
+  sflash_error err;
+  sflash_reader_seek(pReader, iOffset, 0, 0);
+  int found = sflash_reader_next(pReader, &card, &err);
+  if(found < 0)
+    throw deck_error(err);
+  qa.question.clear();
+  qa.answer.clear();
+  if(!found)
+    return;
+  qa.question.assign(unescape(string(card.question, card.question_len)));
+  qa.answer.assign(card.answer, card.answer_len);
+}
+
+void Parser::scan_deck
+(
+  const function<void(const sflash_card&)>& fnCard
+)
+/*
+  Hands every card in the file to `fnCard`, from the start,
+  with a reader of its own: only a card at a time is held.
+  Leaves the file position where it was.
+*/
+{
+  long iResume = file->tell();
+  uint64_t iResumeLine = file->line_number();
+  file->reset_position();
+
+  sflash_reader * pScan = sflash_reader_open(file->handle(),
+    ProgramOptions::pDialect);
+  if(!pScan)
+  {
+    puts("Out of memory");
+    exit(1);
+  }
+  sflash_card card;
+  sflash_error err;
+  int found = 0;
+  while((found = sflash_reader_next(pScan, &card, &err)) > 0)
+    fnCard(card);
+  sflash_reader_close(pScan);
+  file->seek(iResume, iResumeLine);
+  if(found < 0)
+    throw deck_error(err);
+}
+
+void Parser::forget()
+/*
+  After the deck was written to: text read ahead may be stale
+*/
+{
+  sflash_reader_drop(pReader);
+}
+
+runtime_error Parser::deck_error
+(
+  const sflash_error& err
+)
+{
+  if(err.status == SFLASH_ERR_SYNTAX)
+    return runtime_error(string("Syntax error: ") + err.message
+      + " (line " + to_string(err.line) + ")");
+  return runtime_error(string("Error: ") + err.message);
+}
+
+void TermWeights::build
+(
+  Parser& parser
+)
+/*
+  Inverse document frequency of every answer token,
+  counting each card's answer once per token:
+  idf = ln((N + 1) / (df + 1)) + 1
+*/
+{
+  unordered_map<string, uint32_t> mapDF;
+  list<string> lstWords;
+  vector<string> vecSeen;
+  uint64_t iDocs = 0;
+  parser.scan_deck([&](const sflash_card& card)
+  {
+    lstWords.clear();
+    AnswerHandler::load_words(lstWords, string(card.answer, card.answer_len));
+    vecSeen.assign(begin(lstWords), end(lstWords));
+    sort(begin(vecSeen), end(vecSeen));
+    auto last = unique(begin(vecSeen), end(vecSeen));
+    for(auto word = begin(vecSeen); word != last; ++word)
+      mapDF[*word] += 1;
+    ++iDocs;
+  });
+
+  float fDocs = (float) iDocs + 1.0f;
+  mapIDF.clear();
+  mapIDF.reserve(mapDF.size());
+  for(auto df = begin(mapDF); df != end(mapDF); ++df)
+    mapIDF[df->first] = logf(fDocs / (df->second + 1.0f)) + 1.0f;
+  fUnseen = logf(fDocs) + 1.0f;
+}
+
+float TermWeights::weight
+(
+  const string& strWord
+) const
+{
+  auto found = mapIDF.find(strWord);
+  if(found == end(mapIDF))
+    return fUnseen;
+  return found->second;
+}
+
+void TermWeights::weigh
+(
+  QA& qa
+) const
+/*
+  Done once per card, as it is parsed: the words come out
+  in the order AnswerHandler::exec() loads them
+*/
+{
+  qa.vecWeights.clear();
+  sflash_kind kind = sflash_answer_kind(qa.answer.data(), qa.answer.size());
+  if(kind == SFLASH_LIST || kind == SFLASH_SEQUENCE)
+    return;
+  list<string> lstWords;
+  AnswerHandler::load_words(lstWords, qa.answer);
+  for(auto word = begin(lstWords); word != end(lstWords); ++word)
+    qa.vecWeights.push_back(weight(*word));
+}
+
+void AnswerHandler::split
+(
+  sflash_kind kind,
+  const string& strSrc,
+  vector<string>& vecDest,
+  bool typed
+)
+/*
+  Unescaped words or items of an answer, as the core
+  library splits them; `typed` text is never unescaped
+*/
+{
+  auto fnSplit = typed ? &sflash_split_input : &sflash_split;
+  string buf(strSrc.size(), 0);
+  vector<sflash_span> vecSpans(16);
+  size_t iItems = fnSplit(ProgramOptions::pDialect, kind,
+    strSrc.data(), strSrc.size(), &buf[0], vecSpans.data(), vecSpans.size());
+  if(iItems > vecSpans.size())
+  {
+    vecSpans.resize(iItems);
+    fnSplit(ProgramOptions::pDialect, kind,
+      strSrc.data(), strSrc.size(), &buf[0], vecSpans.data(), vecSpans.size());
+  }
+  for(size_t i = 0; i < iItems; ++i)
+    vecDest.push_back(string(vecSpans[i].text, vecSpans[i].len));
+}
+
+void AnswerHandler::load_words
+(
+  list<string>& lstWords,
+  const string& strAnswer,
+  bool typed
+)
+{
+  vector<string> vecWords;
+  split(SFLASH_TOKENS, strAnswer, vecWords, typed);
+  lstWords.insert(end(lstWords), begin(vecWords), end(vecWords));
+}
+
+MatchResults AnswerHandler::compare_words
+(
+  const list<string>& lstWordsAgainst
+)
+{
+  vector<sflash_span> vecReal;
+  for(auto real = begin(lstWords); real != end(lstWords); ++real)
+    vecReal.push_back(sflash_span{real->data(), real->size()});
+  vector<sflash_span> vecGiven;
+  for(auto given = begin(lstWordsAgainst);
+    given != end(lstWordsAgainst); ++given)
+  {
+    vecGiven.push_back(sflash_span{given->data(), given->size()});
+  }
+
+  bool weighted = vecWeights.size() == lstWords.size();
+  sflash_grade grade;
+  sflash_grade_words(vecReal.data(), weighted ? vecWeights.data() : NULL,
+    vecReal.size(), vecGiven.data(), vecGiven.size(), &grade);
+
+  MatchResults ret;
+  ret.iMatches = grade.matches;
+  ret.iTotalWords = grade.total;
+  ret.fMatchedWeight = grade.matched_weight;
+  ret.fTotalWeight = grade.total_weight;
+  return ret;
+}
+
+void AnswerHandler::construct_list()
+{
+  if(used)
+    vecListItems.clear();
+  split(SFLASH_LIST, strAnswer, vecListItems);
+  used = true;
+}
+
+void AnswerHandler::split_sequence
+(
+  const string& strSrc,
+  vector<string>& vecDest,
+  bool typed
+)
+/*
+  Splits "[a, b, c]" (brackets optional) into trimmed items
+*/
+{
+  split(SFLASH_SEQUENCE, strSrc, vecDest, typed);
+}
+
+void AnswerHandler::construct_sequence()
+{
+  vecSequenceItems.clear();
+  split_sequence(strAnswer, vecSequenceItems);
+
+  vector<sflash_span> vecSpans;
+  for(auto item = begin(vecSequenceItems);
+    item != end(vecSequenceItems); ++item)
+  {
+    vecSpans.push_back(sflash_span{item->data(), item->size()});
+  }
+  sflash_sequence_free(pSequence);
+  pSequence = sflash_sequence_compile(vecSpans.data(), vecSpans.size());
+  if(!pSequence)
+  {
+    puts("Out of memory");
+    exit(1);
+  }
+}
+
+MatchResults AnswerHandler::compare_sequence
+(
+  const vector<string>& vecGiven,
+  uint16_t * piPresent
+)
+/*
+  iMatches is the longest common subsequence of the given
+  and the real items; *piPresent counts real items given
+  in any order
+*/
+{
+  vector<sflash_span> vecSpans;
+  for(auto given = begin(vecGiven); given != end(vecGiven); ++given)
+    vecSpans.push_back(sflash_span{given->data(), given->size()});
+
+  sflash_grade grade;
+  uint32_t iPresent = 0;
+  sflash_sequence_grade(pSequence, vecSpans.data(), vecSpans.size(),
+    &grade, &iPresent);
+  *piPresent = iPresent;
+
+  MatchResults ret;
+  ret.iMatches = grade.matches;
+  ret.iTotalWords = grade.total;
+  ret.fMatchedWeight = 0.0f;
+  ret.fTotalWeight = 0.0f;
+  return ret;
+}
+
+void AnswerHandler::exec
+(
+  const QA& qa,
+  fnDecision * fnWhich
+)
+{
+  strAnswer = qa.answer;
+
+  if(ProgramOptions::iChoices > 1)
+  {
+    *fnWhich = &Prompt::choice;
+    return;
+  }
+
+  switch(sflash_answer_kind(strAnswer.data(), strAnswer.size()))
+  {
+  case SFLASH_LIST:
+  {
+    construct_list();
+    *fnWhich = &Prompt::list;
+    break;
+  }
+  case SFLASH_SEQUENCE:
+  {
+    construct_sequence();
+    *fnWhich = &Prompt::sequence;
+    break;
+  }
+  default:
+  {
+    load_words(lstWords, strAnswer);
+    vecWeights = qa.vecWeights;
+    if(ProgramOptions::options & ProgramOptions::live)
+    {
+      mapWordMatches.clear();
+      auto weight = begin(vecWeights);
+      for(auto word = begin(lstWords); word != end(lstWords); ++word)
+      {
+        WordMatch& match = mapWordMatches[*word];
+        match.iCount += 1;
+        if(weight != end(vecWeights))
+          match.fWeight += *weight++;
+      }
+    }
+    *fnWhich = &Prompt::tokens;
+    break;
+  }
+  }
+}
+
+void Prompt::loop()
+{
+  //random draws landing on seen cards are redrawn up to this often
+  static const int kiRedraws = 8;
+  bool resumed = checkpoint.resume();
+
+continue_looping:
+  do
+  {
+    if(ProgramOptions::options & ProgramOptions::randomize && !resumed)
+    {
+      parser.seek_line(parser.file->random_line());
+      for(int r = 0; r < kiRedraws && checkpoint.seen(parser.file->tell()); ++r)
+        parser.seek_line(parser.file->random_line());
+    }
+    resumed = false;
+    parser.split_QAs();
+    for(size_t i = 0; i < parser.vQAs.size(); ++i)
+    {
+      QA * qa = &parser.vQAs[i];
+      posCurrent = parser.vecPositions[i];
+      checkpoint.at(posCurrent, i == 0);
+      //an edited card is asked again, as it is now
+      do
+      {
+        edited = false;
+        ah.exec(*qa, &fnWhich);
+        (this->*fnWhich)(qa);
+      } while(edited);
+      checkpoint.mark_seen(posCurrent.iCard);
+    }
+  } while(!parser.at_end);
+  
+  if(ProgramOptions::options & ProgramOptions::perpetual)
+  {
+    parser.file->reset_position();
+    checkpoint.clear_seen();
+    goto continue_looping;
+  }
+  checkpoint.finish();
+}
+
+void Prompt::tokens
+(
+  QA * qa
+)
+{
+  cout << "Q: " << qa->question << "\n"
+    << "> ";
+  string strUserAnswer;
+  MatchResults res;
+  std::list<string> lstUserAnswer;
+  bool first_attempt = true;
+  uint16_t iHintLevel = 0;
+
+attempt:
+  if(ProgramOptions::options & ProgramOptions::live)
+    read_live(strUserAnswer);
+  else
+    getline(cin, strUserAnswer);
+  if(hint(strUserAnswer,
+    vector<string>(begin(ah.lstWords), end(ah.lstWords)), &iHintLevel))
+  {
+    cout << "> ";
+    strUserAnswer.clear();
+    goto attempt;
+  }
+  if(edit(strUserAnswer, qa))
+    goto end;
+  AnswerHandler::load_words(lstUserAnswer, strUserAnswer, true);
+
+  //TODO a punctuation filter
+  //TODO a word filter removing "the"s
+
+  res = ah.compare_words(lstUserAnswer);
+  if(first_attempt)
+  {
+    log.record(*qa, res.percentage());
+    first_attempt = false;
+  }
+
+  cout << res.iMatches << "/" << res.iTotalWords <<
+    " == " << res.percentage() << "  " << qa->answer << "\n";
+  if(res.percentage() < ProgramOptions::fNoRepeatThreshold)
+  {
+    cout << "Try again.\n> ";
+    lstUserAnswer.clear();
+    strUserAnswer.clear();
+    goto attempt;
+  }
+end:
+  ah.vecWeights.clear();
+  ah.mapWordMatches.clear();
+  ah.lstWords.clear(); //becuase this function controls when we're through with the real answer words
+}
+
+void Prompt::list
+(
+  QA * qa
+)
+{
+  cout << "Q: " << qa->question << "\n"
+    << "> [list input]\n";
+  string strUserAnswer;
+  deque<vector<string>::iterator> dequePreviouslyCorrect;
+  uint16_t iHintLevel = 0;
+  vector<string> vecUnsaid;
+  vector<uint32_t> vecGiven;
+
+  //items given before the session was interrupted
+  for(auto i = begin(checkpoint.list_progress());
+    i != end(checkpoint.list_progress()); ++i)
+  {
+    if(*i < ah.vecListItems.size())
+    {
+      vecGiven.push_back(*i);
+      dequePreviouslyCorrect.push_back(begin(ah.vecListItems) + *i);
+      cout << "  -> " << ah.vecListItems[*i] << "\n";
+    }
+  }
+
+  for(uint16_t successful_answers = dequePreviouslyCorrect.size();
+    successful_answers < ah.vecListItems.size(); ++successful_answers)
+  {
+attempt:
+    cout << "  -> ";
+    getline(cin, strUserAnswer);
+    //escape hatches: "???" and "!!!"
+    if(strUserAnswer == "???")
+    {
+      for(auto i = begin(ah.vecListItems); i != end(ah.vecListItems);
         ++i)
       {
         cout << *i << "\n";
@@ -546,6 +2029,19 @@ attempt:
       }
       goto end;
     }
+    else if(edit(strUserAnswer, qa))
+      return;
+    vecUnsaid.clear();
+    for(auto i = begin(ah.vecListItems); i != end(ah.vecListItems); ++i)
+    {
+      if(find(begin(dequePreviouslyCorrect), end(dequePreviouslyCorrect), i)
+        == end(dequePreviouslyCorrect))
+      {
+        vecUnsaid.push_back(*i);
+      }
+    }
+    if(hint(strUserAnswer, vecUnsaid, &iHintLevel))
+      goto attempt;
 
     for(auto this_item_revisited = begin(ah.vecListItems);
       this_item_revisited != end(ah.vecListItems);
@@ -565,6 +2061,8 @@ attempt:
         }
         cout << "Correct\n";
         dequePreviouslyCorrect.push_back(this_item_revisited);
+        vecGiven.push_back(this_item_revisited - begin(ah.vecListItems));
+        checkpoint.list_progress(vecGiven);
         goto next_iteration;
       }
     }
@@ -575,5 +2073,2796 @@ next_iteration:
     ;
   }
 end:
-  ;
+  log.record(*qa, ah.vecListItems.empty() ? 1.0f :
+    (float) dequePreviouslyCorrect.size() / ah.vecListItems.size());
+}
+
+
+static inline uint64_t mix64
+(
+  uint64_t x
+)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+static inline uint32_t thread_count()
+{
+  uint32_t iThreads = ProgramOptions::iThreads;
+  if(!iThreads)
+    iThreads = thread::hardware_concurrency();
+  if(!iThreads)
+    iThreads = 1;
+  return iThreads;
+}
+
+void Deduper::signature
+(
+  const string& strText,
+  uint32_t * pSig,
+  uint16_t iHashes
+)
+/*
+  MinHash over 5-character shingles of the lowercased,
+  punctuation-collapsed text. The iHashes hash functions
+  are derived from two base hashes per shingle
+  (h1 + i * h2), so each shingle is hashed only once.
+*/
+{
+  static const size_t kiShingle = 5;
+
+  string strNorm;
+  strNorm.reserve(strText.size());
+  for(auto ch = begin(strText); ch != end(strText); ++ch)
+  {
+    unsigned char c = *ch;
+    if(isalnum(c))
+      strNorm.append(1, tolower(c));
+    else if(!strNorm.empty() && strNorm.back() != ' ')
+      strNorm.append(1, ' ');
+  }
+  if(!strNorm.empty() && strNorm.back() == ' ')
+    strNorm.erase(strNorm.size() - 1);
+
+  for(uint16_t i = 0; i < iHashes; ++i)
+    pSig[i] = UINT32_MAX;
+
+  size_t iShingles = strNorm.size() < kiShingle ?
+    1 : strNorm.size() - kiShingle + 1;
+  for(size_t s = 0; s < iShingles; ++s)
+  {
+    //FNV-1a
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for(size_t c = s; c < s + kiShingle && c < strNorm.size(); ++c)
+    {
+      h ^= (unsigned char) strNorm[c];
+      h *= 0x100000001b3ULL;
+    }
+    uint64_t h1 = mix64(h);
+    uint64_t h2 = mix64(h ^ 0x9e3779b97f4a7c15ULL) | 1;
+    for(uint16_t i = 0; i < iHashes; ++i)
+    {
+      uint32_t hi = (h1 + i * h2) >> 32;
+      if(hi < pSig[i])
+        pSig[i] = hi;
+    }
+  }
+}
+
+void Deduper::compute_signatures()
+/*
+  Reads the deck once, keeping only where each card starts and
+  its signature; the text of kiBatch cards at a time is signed
+  on all cores
+*/
+{
+  static const size_t kiBatch = 1 << 14;
+  vector<string> vTexts;
+  size_t iPending = 0;
+  parser.scan_deck([&](const sflash_card& card)
+  {
+    if(!sflash_offsets_push(pOffsets, card.offset))
+    {
+      puts("Out of memory");
+      exit(1);
+    }
+    if(iPending == vTexts.size())
+      vTexts.push_back(string());
+    string& strText = vTexts[iPending++];
+    strText.assign(Parser::unescape(string(card.question, card.question_len)));
+    strText.append(1, ' ');
+    strText.append(card.answer, card.answer_len);
+    if(iPending == kiBatch)
+    {
+      sign_batch(vTexts, iPending);
+      iPending = 0;
+    }
+  });
+  sign_batch(vTexts, iPending);
+}
+
+void Deduper::sign_batch
+(
+  const vector<string>& vTexts,
+  size_t iCount
+)
+/*
+  Signs the first `iCount` texts as the next cards
+*/
+{
+  size_t iFirst = iCards;
+  iCards += iCount;
+  vSignatures.resize(iCards * kiHashes);
+
+  uint32_t iThreads = thread_count();
+  vector<thread> vWorkers;
+  size_t iPer = (iCount + iThreads - 1) / iThreads;
+  for(uint32_t t = 0; t < iThreads; ++t)
+  {
+    size_t iFrom = t * iPer;
+    size_t iTo = min(iCount, iFrom + iPer);
+    if(iFrom >= iTo)
+      break;
+    vWorkers.push_back(thread([this, &vTexts, iFirst, iFrom, iTo]()
+    {
+      for(size_t i = iFrom; i < iTo; ++i)
+        signature(vTexts[i], &vSignatures[(iFirst + i) * kiHashes]);
+    }));
+  }
+  for(auto w = begin(vWorkers); w != end(vWorkers); ++w)
+    w->join();
+}
+
+float Deduper::similarity
+(
+  uint32_t a,
+  uint32_t b
+)
+{
+  const uint32_t * pA = &vSignatures[(size_t) a * kiHashes];
+  const uint32_t * pB = &vSignatures[(size_t) b * kiHashes];
+  uint16_t iEqual = 0;
+  for(uint16_t i = 0; i < kiHashes; ++i)
+    iEqual += pA[i] == pB[i];
+  return (float) iEqual / kiHashes;
+}
+
+void Deduper::find_candidates
+(
+  uint16_t iBand,
+  uint16_t iRows,
+  vector<pair<uint32_t, uint32_t>>& vPairs
+)
+/*
+  Buckets every card by the hash of its rows in band `iBand`.
+  Buckets of up to kiAllPairs cards verify every pair. In larger
+  ones each card is verified against the first kiLeaders cards
+  that matched none before them, so they cost linear time; the
+  clusters are joined transitively afterwards.
+*/
+{
+  vector<pair<uint64_t, uint32_t>> vKeys(iCards);
+  vector<uint32_t> vLeaders;
+  for(uint32_t i = 0; i < iCards; ++i)
+  {
+    const uint32_t * pSig = &vSignatures[(size_t) i * kiHashes + iBand * iRows];
+    uint64_t key = iBand;
+    for(uint16_t r = 0; r < iRows; ++r)
+      key = mix64(key ^ pSig[r]);
+    vKeys[i] = make_pair(key, i);
+  }
+  sort(begin(vKeys), end(vKeys));
+
+  for(size_t i = 0; i < vKeys.size(); )
+  {
+    size_t j = i + 1;
+    while(j < vKeys.size() && vKeys[j].first == vKeys[i].first)
+      ++j;
+    if(j - i <= kiAllPairs)
+    {
+      for(size_t a = i; a < j; ++a)
+        for(size_t b = a + 1; b < j; ++b)
+        {
+          if(similarity(vKeys[a].second, vKeys[b].second)
+            >= ProgramOptions::fDedupeThreshold)
+          {
+            vPairs.push_back(make_pair(vKeys[a].second, vKeys[b].second));
+          }
+        }
+    }
+    else
+    {
+      vLeaders.clear();
+      for(size_t k = i; k < j; ++k)
+      {
+        uint32_t iCard = vKeys[k].second;
+        auto l = begin(vLeaders);
+        while(l != end(vLeaders)
+          && similarity(*l, iCard) < ProgramOptions::fDedupeThreshold)
+        {
+          ++l;
+        }
+        if(l != end(vLeaders))
+          vPairs.push_back(make_pair(*l, iCard));
+        else if(vLeaders.size() < kiLeaders)
+          vLeaders.push_back(iCard);
+      }
+    }
+    i = j;
+  }
+}
+
+uint32_t Deduper::find_root
+(
+  uint32_t i
+)
+{
+  while(vParents[i] != i)
+  {
+    vParents[i] = vParents[vParents[i]];
+    i = vParents[i];
+  }
+  return i;
+}
+
+void Deduper::report()
+{
+  compute_signatures();
+  if(!iCards)
+  {
+    cout << "No cards found\n";
+    return;
+  }
+
+  //Pick the band layout whose S-curve threshold, (1/b)^(1/r),
+  //sits closest below the requested similarity
+  uint16_t iRows = 1;
+  for(uint16_t r = 1; r <= kiHashes; r *= 2)
+  {
+    float fCurve = pow(1.0f / (kiHashes / r), 1.0f / r);
+    if(fCurve > ProgramOptions::fDedupeThreshold)
+      break;
+    iRows = r;
+  }
+  uint16_t iBands = kiHashes / iRows;
+
+  uint32_t iThreads = thread_count();
+  vector<vector<pair<uint32_t, uint32_t>>> vPairs(iThreads);
+  atomic<uint16_t> iNextBand(0);
+  vector<thread> vWorkers;
+  for(uint32_t t = 0; t < iThreads && t < iBands; ++t)
+  {
+    vWorkers.push_back(thread([this, t, iRows, iBands, &iNextBand, &vPairs]()
+    {
+      uint16_t b;
+      while((b = iNextBand++) < iBands)
+        find_candidates(b, iRows, vPairs[t]);
+    }));
+  }
+  for(auto w = begin(vWorkers); w != end(vWorkers); ++w)
+    w->join();
+
+  vParents.resize(iCards);
+  for(uint32_t i = 0; i < vParents.size(); ++i)
+    vParents[i] = i;
+  for(auto v = begin(vPairs); v != end(vPairs); ++v)
+  {
+    for(auto p = begin(*v); p != end(*v); ++p)
+    {
+      uint32_t a = find_root(p->first);
+      uint32_t b = find_root(p->second);
+      if(a != b)
+        vParents[max(a, b)] = min(a, b);
+    }
+  }
+
+  vector<pair<uint32_t, uint32_t>> vMembers; //(root, card)
+  for(uint32_t i = 0; i < vParents.size(); ++i)
+    vMembers.push_back(make_pair(find_root(i), i));
+  sort(begin(vMembers), end(vMembers));
+
+  uint32_t iClusters = 0;
+  QA qa;
+  for(size_t i = 0; i < vMembers.size(); )
+  {
+    size_t j = i + 1;
+    while(j < vMembers.size() && vMembers[j].first == vMembers[i].first)
+      ++j;
+    if(j - i > 1)
+    {
+      ++iClusters;
+      cout << "Cluster " << iClusters << " (" << j - i << " cards):\n";
+      for(size_t k = i; k < j; ++k)
+      {
+        uint32_t iCard = vMembers[k].second;
+        parser.card_at(sflash_offsets_get(pOffsets, iCard), qa);
+        cout << "  #" << iCard + 1 << " ["
+          << (int)(similarity(vMembers[i].second, iCard) * 100) << "%] "
+          << qa.question << " / " << qa.answer << "\n";
+      }
+    }
+    i = j;
+  }
+  cout << iClusters << " clusters of near-duplicate cards among "
+    << iCards << " cards\n";
+}
+
+void Prompt::sequence
+(
+  QA * qa
+)
+{
+  char cSeparator = sflash_dialect_separator(ProgramOptions::pDialect);
+  cout << "Q: " << qa->question << "\n"
+    << "> [ordered input, " << (cSeparator == ',' ? string("comma") :
+      "'" + string(1, cSeparator) + "'") << " separated]\n> ";
+  string strUserAnswer;
+  vector<string> vecUserItems;
+  MatchResults res;
+  uint16_t iPresent = 0;
+  bool first_attempt = true;
+
+attempt:
+  getline(cin, strUserAnswer);
+  if(edit(strUserAnswer, qa))
+    return;
+  AnswerHandler::split_sequence(strUserAnswer, vecUserItems, true);
+
+  res = ah.compare_sequence(vecUserItems, &iPresent);
+  if(first_attempt)
+  {
+    log.record(*qa, res.percentage());
+    first_attempt = false;
+  }
+
+  cout << res.iMatches << "/" << res.iTotalWords << " in order, "
+    << iPresent << "/" << res.iTotalWords << " present == "
+    << res.percentage() << "  " << qa->answer << "\n";
+  if(res.percentage() < ProgramOptions::fNoRepeatThreshold)
+  {
+    cout << "Try again.\n> ";
+    vecUserItems.clear();
+    strUserAnswer.clear();
+    goto attempt;
+  }
+}
+
+Importer::Importer
+(
+  const char * szFrom,
+  char cDelim_
+)
+{
+  cDelim = cDelim_;
+  cListSep = 0;
+  //a TSV field may well hold a stray '"'
+  quoting = cDelim != '\t' || ProgramOptions::import_quotes;
+
+  FILE * pFile = fopen(szFrom, "rb");
+  if(!pFile)
+  {
+    puts("File not found error");
+    exit(1);
+  }
+  vector<char> buf(File::kiBlock);
+  size_t iRead = 0;
+  while((iRead = fread(buf.data(), 1, buf.size(), pFile)) > 0)
+    vecInput.insert(end(vecInput), begin(buf), begin(buf) + iRead);
+  fclose(pFile);
+}
+
+uint8_t Importer::step
+(
+  uint8_t state,
+  char c
+) const
+/*
+  A '"' only opens quotes as the first char of a field;
+  anywhere else outside quotes it is literal
+*/
+{
+  switch(state)
+  {
+    case kQuoted:
+      return c == '"' ? kQuotedQuote : kQuoted;
+    case kQuotedQuote:
+      if(c == '"')
+        return kQuoted;
+      break;
+    case kFieldStart:
+      if(c == '"' && quoting)
+        return kQuoted;
+      break;
+    default:
+      break;
+  }
+  return c == cDelim || c == '\n' ? kFieldStart : kUnquoted;
+}
+
+size_t Importer::record_start
+(
+  size_t iPos,
+  uint8_t state
+)
+/*
+  First record starting at or after `iPos`, given the
+  quote state at `iPos`
+*/
+{
+  for(; iPos < vecInput.size(); ++iPos)
+  {
+    char c = vecInput[iPos];
+    if(c == '\n' && state != kQuoted)
+      return iPos + 1;
+    state = step(state, c);
+  }
+  return vecInput.size();
+}
+
+size_t Importer::parse_record
+(
+  size_t iPos,
+  vector<string>& vecFields
+)
+/*
+  RFC 4180 style: a field may be quoted, and inside quotes
+  the delimiter and newlines are literal and "" is a quote
+
+  Returns: offset just past the record
+*/
+{
+  vecFields.clear();
+  string field;
+  uint8_t state = kFieldStart;
+
+  for(; iPos < vecInput.size(); ++iPos)
+  {
+    char c = vecInput[iPos];
+    uint8_t next = step(state, c);
+    if(state == kQuoted || state == kQuotedQuote)
+    {
+      //the quotes that open, close and escape are not text
+      if(next == kQuoted && c != '"')
+        field.append(1, c);
+      else if(next == kQuoted)
+        field.append(1, '"');
+      else if(next == kUnquoted && c != '\r')
+        field.append(1, c);
+    }
+    else if(next == kUnquoted && c != '\r')
+      field.append(1, c);
+
+    if(next == kFieldStart && state != kQuoted)
+    {
+      vecFields.push_back(field);
+      field.clear();
+      if(c == '\n')
+        return iPos + 1;
+    }
+    state = next;
+  }
+  vecFields.push_back(field);
+  return iPos;
+}
+
+void Importer::detect_lists()
+/*
+  The answer column is list-valued when most of the answers
+  in the first rows split into several items on ';' or '|'
+*/
+{
+  static const uint32_t kiSample = 1000;
+  static const char seps[] = { ';', '|' };
+
+  uint32_t iValues = 0;
+  uint32_t iLists[2] = { 0, 0 };
+  vector<string> vecFields;
+  size_t iPos = 0;
+  for(uint32_t i = 0; i < kiSample && iPos < vecInput.size(); ++i)
+  {
+    iPos = parse_record(iPos, vecFields);
+    if((i == 0 && ProgramOptions::import_header)
+      || vecFields.size() < ProgramOptions::iImportAnswerColumn)
+    {
+      continue;
+    }
+    const string& strAnswer = vecFields[ProgramOptions::iImportAnswerColumn - 1];
+    if(strAnswer.empty())
+      continue;
+    ++iValues;
+    for(int s = 0; s < 2; ++s)
+    {
+      size_t iSep = strAnswer.find(seps[s]);
+      if(iSep != string::npos && iSep > 0 && iSep + 1 < strAnswer.size())
+        ++iLists[s];
+    }
+  }
+
+  int best = iLists[1] > iLists[0];
+  if(iValues && iLists[best] * 2 > iValues)
+    cListSep = seps[best];
+}
+
+void Importer::escape
+(
+  const string& strSrc,
+  Field field,
+  string& strDest
+)
+/*
+  Appends `strSrc` with whitespace runs and line breaks folded
+  to single spaces, escaping with `\` only what the deck parsers
+  would take as syntax there: a marker starting the field, a
+  bracket starting an answer, and in list items the separator
+  and braces. A '\' is escaped when it would escape what follows
+  it, which in a list item may be the next separator.
+
+  Braces in the rest of an answer are left alone when they pair
+  up unnested; otherwise `check` would report them, so they are
+  all escaped.
+*/
+{
+  bool paired = true;
+  if(field == kAnswer)
+  {
+    size_t iFirst = strSrc.find_first_not_of(" \t\n\r");
+    uint32_t iDepth = 0;
+    for(size_t i = iFirst; paired && i < strSrc.size(); ++i)
+    {
+      if(strSrc[i] == '{' && i != iFirst)
+        paired = iDepth++ == 0;
+      else if(strSrc[i] == '}')
+        paired = iDepth-- == 1;
+    }
+    paired = paired && !iDepth;
+  }
+
+  bool space = true; //drops leading blanks
+  size_t iStart = strDest.size();
+  for(auto ch = begin(strSrc); ch != end(strSrc); ++ch)
+  {
+    bool first = strDest.size() == iStart;
+    switch(*ch)
+    {
+      case ' ': case '\t': case '\n': case '\r':
+      {
+        if(!space)
+          strDest.append(1, ' ');
+        space = true;
+        continue;
+      }
+      case '-': case '+':
+      {
+        if(first)
+          strDest.append(1, '\\');
+        break;
+      }
+      case '[':
+      {
+        if(first && field == kAnswer)
+          strDest.append(1, '\\');
+        break;
+      }
+      case '{':
+      {
+        if(field == kItem || (field == kAnswer && (first || !paired)))
+          strDest.append(1, '\\');
+        break;
+      }
+      case '}':
+      {
+        if(field == kItem || (field == kAnswer && !paired))
+          strDest.append(1, '\\');
+        break;
+      }
+      case ',':
+      {
+        if(field == kItem)
+          strDest.append(1, '\\');
+        break;
+      }
+      case '\\':
+      {
+        if(field == kItem || (ch + 1 != end(strSrc) && sflash_escapable(ch[1])))
+          strDest.append(1, '\\');
+        break;
+      }
+      default:
+        break;
+    }
+    strDest.append(1, *ch);
+    space = false;
+  }
+  if(strDest.size() > iStart && strDest.back() == ' ')
+    strDest.erase(strDest.size() - 1);
+}
+
+void Importer::format_records
+(
+  size_t iFrom,
+  size_t iTo,
+  string& strDest,
+  uint64_t * piCards
+)
+/*
+  Formats the records starting in [iFrom, iTo) as cards
+*/
+{
+  vector<string> vecFields;
+  string strQuestion;
+  string strAnswer;
+  string strItem;
+  *piCards = 0;
+
+  for(size_t iPos = iFrom; iPos < iTo; )
+  {
+    bool header = iPos == 0 && ProgramOptions::import_header;
+    iPos = parse_record(iPos, vecFields);
+    if(header
+      || vecFields.size() < ProgramOptions::iImportQuestionColumn
+      || vecFields.size() < ProgramOptions::iImportAnswerColumn)
+    {
+      continue;
+    }
+
+    strQuestion.clear();
+    escape(vecFields[ProgramOptions::iImportQuestionColumn - 1], kQuestion, strQuestion);
+
+    const string& strField = vecFields[ProgramOptions::iImportAnswerColumn - 1];
+    strAnswer.clear();
+    uint32_t iItems = 0;
+    if(cListSep)
+    {
+      strAnswer.append(1, '{');
+      size_t iItem = 0;
+      while(iItem <= strField.size())
+      {
+        size_t iSep = strField.find(cListSep, iItem);
+        if(iSep == string::npos)
+          iSep = strField.size();
+        strItem.clear();
+        escape(strField.substr(iItem, iSep - iItem), kItem, strItem);
+        if(!strItem.empty())
+        {
+          if(iItems++)
+            strAnswer.append(", ");
+          strAnswer.append(strItem);
+        }
+        iItem = iSep + 1;
+      }
+      strAnswer.append(1, '}');
+    }
+    if(iItems < 2)
+    {
+      strAnswer.clear();
+      escape(strField, kAnswer, strAnswer);
+    }
+
+    if(strQuestion.empty() || strAnswer.empty())
+      continue;
+
+    strDest.append(1, '-');
+    strDest.append(strQuestion);
+    strDest.append("\n+");
+    strDest.append(strAnswer);
+    strDest.append(1, '\n');
+    *piCards += 1;
+  }
+}
+
+void Importer::write
+(
+  const char * szOut
+)
+/*
+  Splits the input into chunks and formats them on all cores.
+  Each chunk first works out the quote state it ends in for
+  every state it could start in; chaining those in order gives
+  every chunk its real starting state, so each can then find
+  the first record that starts inside it independently.
+*/
+{
+  detect_lists();
+
+  uint32_t iThreads = thread_count();
+  size_t iChunks = iThreads * 4;
+  size_t iPer = vecInput.size() / iChunks + 1;
+
+  vector<array<uint8_t, kStates>> vecExits(iChunks);
+  vector<uint8_t> vecEntry(iChunks + 1, kFieldStart);
+  vector<size_t> vecStarts(iChunks + 1, vecInput.size());
+  vector<string> vecOutput(iChunks);
+  vector<uint64_t> vecCards(iChunks, 0);
+
+  auto parallel = [&](function<void(size_t)> fnChunk)
+  {
+    atomic<size_t> iNext(0);
+    vector<thread> vWorkers;
+    for(uint32_t t = 0; t < iThreads; ++t)
+    {
+      vWorkers.push_back(thread([&]()
+      {
+        size_t c;
+        while((c = iNext++) < iChunks)
+          fnChunk(c);
+      }));
+    }
+    for(auto w = begin(vWorkers); w != end(vWorkers); ++w)
+      w->join();
+  };
+
+  parallel([&](size_t c)
+  {
+    size_t iFrom = min(vecInput.size(), c * iPer);
+    size_t iTo = min(vecInput.size(), iFrom + iPer);
+    array<uint8_t, kStates>& exits = vecExits[c];
+    for(uint8_t s = 0; s < kStates; ++s)
+      exits[s] = s;
+    size_t i = iFrom;
+    //the runs mostly meet at the first newline outside quotes
+    for(; i < iTo && !(exits[0] == exits[1] && exits[1] == exits[2]
+      && exits[2] == exits[3]); ++i)
+    {
+      for(uint8_t s = 0; s < kStates; ++s)
+        exits[s] = step(exits[s], vecInput[i]);
+    }
+    uint8_t state = exits[0];
+    for(; i < iTo; ++i)
+      state = step(state, vecInput[i]);
+    if(exits[0] == exits[1] && exits[1] == exits[2] && exits[2] == exits[3])
+      exits.fill(state);
+  });
+  for(size_t c = 0; c < iChunks; ++c)
+    vecEntry[c + 1] = vecExits[c][vecEntry[c]];
+
+  parallel([&](size_t c)
+  {
+    size_t iFrom = min(vecInput.size(), c * iPer);
+    vecStarts[c] = c ? record_start(iFrom, vecEntry[c]) : 0;
+  });
+
+  parallel([&](size_t c)
+  {
+    format_records(vecStarts[c], max(vecStarts[c], vecStarts[c + 1]),
+      vecOutput[c], &vecCards[c]);
+  });
+
+  FILE * pOut = fopen(szOut, "wb");
+  if(!pOut)
+  {
+    puts("Could not open output file");
+    exit(1);
+  }
+  uint64_t iCards = 0;
+  for(size_t c = 0; c < iChunks; ++c)
+  {
+    fwrite(vecOutput[c].data(), 1, vecOutput[c].size(), pOut);
+    iCards += vecCards[c];
+  }
+  fclose(pOut);
+
+  cout << "Imported " << iCards << " cards";
+  if(cListSep)
+    cout << " (answers split into lists on '" << cListSep << "')";
+  cout << "\n";
+}
+
+static inline uint32_t fnv1a32
+(
+  const char * p,
+  size_t iLen
+)
+{
+  uint32_t h = 2166136261u;
+  for(size_t i = 0; i < iLen; ++i)
+  {
+    h ^= (unsigned char) p[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static inline uint64_t fnv1a64
+(
+  const char * p,
+  size_t iLen
+)
+{
+  uint64_t h = 14695981039346656037ULL;
+  for(size_t i = 0; i < iLen; ++i)
+  {
+    h ^= (unsigned char) p[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+uint64_t ReviewLog::card_id
+(
+  const string& strQuestion,
+  bool legacy
+)
+/*
+  Cards are identified by their question text, trimmed,
+  so an id survives cards being moved around the deck.
+  64 bits, as 32 would collide within a few 10k cards and
+  merge their stats; legacy gives the old 32-bit id.
+*/
+{
+  size_t iFrom = 0;
+  size_t iTo = strQuestion.size();
+  while(iFrom < iTo && isspace((unsigned char) strQuestion[iFrom]))
+    ++iFrom;
+  while(iTo > iFrom && isspace((unsigned char) strQuestion[iTo - 1]))
+    --iTo;
+  if(legacy)
+    return fnv1a32(strQuestion.data() + iFrom, iTo - iFrom);
+  return fnv1a64(strQuestion.data() + iFrom, iTo - iFrom);
+}
+
+uint32_t ReviewLog::deck_id
+(
+  const char * szDeck
+)
+{
+  const char * szName = strrchr(szDeck, '/');
+  szName = szName ? szName + 1 : szDeck;
+  return fnv1a32(szName, strlen(szName));
+}
+
+FILE * ReviewLog::open_column
+(
+  const string& strPrefix,
+  const char * szColumn
+)
+{
+  FILE * pColumn = fopen((strPrefix + szColumn).c_str(), "ab");
+  if(!pColumn)
+  {
+    puts("Could not open review history");
+    exit(1);
+  }
+  return pColumn;
+}
+
+void ReviewLog::open
+(
+  const char * szPrefix,
+  const char * szDeck
+)
+{
+  string strPrefix(szPrefix);
+  widen_cards(strPrefix);
+  pCard = open_column(strPrefix, ".card64");
+  pDeck = open_column(strPrefix, ".deck");
+  pTime = open_column(strPrefix, ".time");
+  pScore = open_column(strPrefix, ".score");
+  iDeck = deck_id(szDeck);
+  used = true;
+
+  //name the deck id once
+  char line[512];
+  bool named = false;
+  FILE * pNames = fopen((strPrefix + ".decks").c_str(), "r");
+  if(pNames)
+  {
+    while(!named && fgets(line, sizeof(line), pNames))
+      named = strtoul(line, NULL, 16) == iDeck;
+    fclose(pNames);
+  }
+  if(!named && (pNames = fopen((strPrefix + ".decks").c_str(), "a")))
+  {
+    const char * szName = strrchr(szDeck, '/');
+    fprintf(pNames, "%08x %s\n", iDeck, szName ? szName + 1 : szDeck);
+    fclose(pNames);
+  }
+}
+
+void ReviewLog::widen_cards
+(
+  const string& strPrefix
+)
+/*
+  Carries an old 32-bit .card column over to .card64, so the
+  columns stay in step. The old ids keep their values, they
+  cannot be recomputed without the question text.
+*/
+{
+  FILE * pOld = fopen((strPrefix + ".card").c_str(), "rb");
+  if(!pOld)
+    return;
+  FILE * pNew = fopen((strPrefix + ".card64").c_str(), "rb");
+  if(pNew)
+  {
+    fclose(pNew);
+    fclose(pOld);
+    return;
+  }
+  pNew = open_column(strPrefix, ".card64");
+  uint32_t iOld = 0;
+  while(fread(&iOld, sizeof(iOld), 1, pOld) == 1)
+  {
+    uint64_t iCard = iOld;
+    fwrite(&iCard, sizeof(iCard), 1, pNew);
+  }
+  fclose(pOld);
+  fclose(pNew);
+}
+
+ReviewLog::~ReviewLog()
+{
+  if(!used)
+    return;
+  fclose(pCard);
+  fclose(pDeck);
+  fclose(pTime);
+  fclose(pScore);
+}
+
+void ReviewLog::record
+(
+  const QA& qa,
+  float fScore
+)
+{
+  if(!used || qa.question.find_first_not_of(" \t\r\n") == string::npos)
+    return;
+  uint64_t iCard = card_id(qa.question);
+  uint32_t iTime = time(NULL);
+  fwrite(&iCard, sizeof(iCard), 1, pCard);
+  fwrite(&iDeck, sizeof(iDeck), 1, pDeck);
+  fwrite(&iTime, sizeof(iTime), 1, pTime);
+  fwrite(&fScore, sizeof(fScore), 1, pScore);
+  //a review is a few bytes; keep the columns in step if we are killed
+  fflush(pCard);
+  fflush(pDeck);
+  fflush(pTime);
+  fflush(pScore);
+}
+
+FILE * Stats::open_column
+(
+  const char * szColumn,
+  size_t iWidth,
+  size_t iRow
+)
+/*
+  Opens a column of iWidth-byte values, positioned at iRow
+*/
+{
+  FILE * pColumn = fopen((strPrefix + szColumn).c_str(), "rb");
+  if(!pColumn)
+  {
+    puts("Could not open review history");
+    exit(1);
+  }
+  fseek(pColumn, (long) (iRow * iWidth), SEEK_SET);
+  return pColumn;
+}
+
+Stats::Stats
+(
+  const char * szPrefix
+)
+  :strPrefix(szPrefix), szCards(".card64"), iCardWidth(sizeof(uint64_t))
+{
+  FILE * pCards = fopen((strPrefix + szCards).c_str(), "rb");
+  if(pCards)
+    fclose(pCards);
+  else
+  {
+    //a history no session has opened since ids took 64 bits
+    szCards = ".card";
+    iCardWidth = sizeof(uint32_t);
+  }
+  const char * szColumns[] = { szCards, ".deck", ".time", ".score" };
+  size_t iWidths[] = { iCardWidth, sizeof(uint32_t), sizeof(uint32_t), sizeof(float) };
+  //a run cut short may leave the columns one write apart
+  iRows = SIZE_MAX;
+  for(int c = 0; c < 4; ++c)
+  {
+    FILE * pColumn = open_column(szColumns[c], iWidths[c], 0);
+    fseek(pColumn, 0, SEEK_END);
+    iRows = min(iRows, (size_t) ftell(pColumn) / iWidths[c]);
+    fclose(pColumn);
+  }
+}
+
+void Stats::report()
+/*
+  Each thread streams a slice of the columns a block at a
+  time, so memory does not grow with the history. The time
+  column is filtered first, in a loop with no branches, and
+  only the rows kept are gathered from the other columns.
+  Nothing is hashed per row: weeks are counted in an array
+  indexed by week number, decks in a short list, and cards by
+  sorting each block's (card, score) pairs and folding the
+  runs. Runs are merged, not sorted again, as cards pile up
+  and when the threads' results are put together.
+*/
+{
+  struct Group
+  {
+    double fScore;
+    uint32_t iReviews;
+    uint32_t iPassed;
+    void add(const Group& other)
+    {
+      fScore += other.fScore;
+      iReviews += other.iReviews;
+      iPassed += other.iPassed;
+    }
+  };
+  struct Review
+  {
+    uint64_t iCard;
+    float fScore;
+    bool operator<(const Review& other) const
+    {
+      return iCard < other.iCard;
+    }
+  };
+  typedef vector<pair<uint64_t, Group>> Groups;
+  const uint32_t kWeek = 7 * 86400;
+  const size_t kBlock = 1 << 16;
+
+  /*
+    Merges groups, made of runs sorted by key starting at
+    vecRuns, pairwise until one run is left, folds equal keys
+    together and leaves vecRuns ready for the next runs
+  */
+  auto fold = [](Groups& groups, vector<size_t>& vecRuns)
+  {
+    auto byKey = [](const pair<uint64_t, Group>& a, const pair<uint64_t, Group>& b)
+    {
+      return a.first < b.first;
+    };
+    vecRuns.push_back(groups.size());
+    while(vecRuns.size() > 2)
+    {
+      size_t iOut = 0;
+      size_t r = 0;
+      for(; r + 2 < vecRuns.size(); r += 2)
+      {
+        inplace_merge(begin(groups) + vecRuns[r], begin(groups) + vecRuns[r + 1],
+          begin(groups) + vecRuns[r + 2], byKey);
+        vecRuns[iOut++] = vecRuns[r];
+      }
+      if(r + 1 < vecRuns.size())
+        vecRuns[iOut++] = vecRuns[r]; //odd one out
+      vecRuns[iOut++] = vecRuns.back();
+      vecRuns.resize(iOut);
+    }
+    size_t iOut = 0;
+    for(size_t i = 0; i < groups.size(); ++i)
+    {
+      if(iOut && groups[iOut - 1].first == groups[i].first)
+        groups[iOut - 1].second.add(groups[i].second);
+      else
+        groups[iOut++] = groups[i];
+    }
+    groups.resize(iOut);
+    vecRuns.assign(1, 0);
+  };
+
+  uint32_t iSince = 0;
+  uint32_t iNow = time(NULL);
+  if(ProgramOptions::iStatsDays && iNow > ProgramOptions::iStatsDays * 86400u)
+    iSince = iNow - ProgramOptions::iStatsDays * 86400u;
+  float fPass = ProgramOptions::fNoRepeatThreshold;
+
+  uint32_t iThreads = thread_count();
+  vector<Groups> vecByCard(iThreads);
+  vector<Groups> vecByDeck(iThreads);
+  vector<vector<Group>> vecByWeek(iThreads);
+  vector<thread> vWorkers;
+  size_t iPer = iRows / iThreads + 1;
+  for(uint32_t t = 0; t < iThreads; ++t)
+  {
+    vWorkers.push_back(thread([&, t]()
+    {
+      size_t iFrom = min(iRows, t * iPer);
+      size_t iTo = min(iRows, iFrom + iPer);
+      Groups& byCard = vecByCard[t];
+      Groups& byDeck = vecByDeck[t];
+      vector<Group>& byWeek = vecByWeek[t];
+      byWeek.assign(UINT32_MAX / kWeek + 1, Group());
+      FILE * pCard = open_column(szCards, iCardWidth, iFrom);
+      FILE * pDeck = open_column(".deck", sizeof(uint32_t), iFrom);
+      FILE * pTime = open_column(".time", sizeof(uint32_t), iFrom);
+      FILE * pScore = open_column(".score", sizeof(float), iFrom);
+      vector<uint32_t> vecTime(kBlock);
+      vector<uint32_t> vecKeep(kBlock);
+      vector<uint64_t> vecCard(kBlock);
+      vector<uint32_t> vecDeck(kBlock);
+      vector<float> vecScore(kBlock);
+      vector<Review> vecReviews;
+      vector<size_t> vecRuns(1, 0);
+      size_t iFolded = 0; //byCard size when last folded
+      size_t iDeck = 0; //the deck hit last
+      for(size_t iRow = iFrom; iRow < iTo; iRow += kBlock)
+      {
+        size_t n = min(kBlock, iTo - iRow);
+        if(fread(vecTime.data(), sizeof(uint32_t), n, pTime) != n)
+        {
+          puts("Could not read review history");
+          exit(1);
+        }
+        size_t iKept = 0;
+        for(size_t i = 0; i < n; ++i)
+        {
+          vecKeep[iKept] = i;
+          iKept += vecTime[i] >= iSince;
+        }
+        if(!iKept)
+        {
+          fseek(pCard, (long) (n * iCardWidth), SEEK_CUR);
+          fseek(pDeck, (long) (n * sizeof(uint32_t)), SEEK_CUR);
+          fseek(pScore, (long) (n * sizeof(float)), SEEK_CUR);
+          continue;
+        }
+        bool read = fread(vecCard.data(), iCardWidth, n, pCard) == n
+          && fread(vecDeck.data(), sizeof(uint32_t), n, pDeck) == n
+          && fread(vecScore.data(), sizeof(float), n, pScore) == n;
+        if(!read)
+        {
+          puts("Could not read review history");
+          exit(1);
+        }
+        if(iCardWidth == sizeof(uint32_t))
+        {
+          //widen in place, from the back so nothing is overwritten unread
+          const uint32_t * pNarrow = (const uint32_t *) vecCard.data();
+          for(size_t i = n; i-- > 0;)
+            vecCard[i] = pNarrow[i];
+        }
+
+        vecReviews.resize(iKept);
+        for(size_t k = 0; k < iKept; ++k)
+        {
+          size_t i = vecKeep[k];
+          Group g = { vecScore[i], 1, vecScore[i] >= fPass };
+          byWeek[vecTime[i] / kWeek].add(g);
+          if(iDeck >= byDeck.size() || byDeck[iDeck].first != vecDeck[i])
+          {
+            for(iDeck = 0; iDeck < byDeck.size(); ++iDeck)
+            {
+              if(byDeck[iDeck].first == vecDeck[i])
+                break;
+            }
+            if(iDeck == byDeck.size())
+              byDeck.push_back(make_pair((uint64_t) vecDeck[i], Group()));
+          }
+          byDeck[iDeck].second.add(g);
+          vecReviews[k].iCard = vecCard[i];
+          vecReviews[k].fScore = vecScore[i];
+        }
+
+        sort(begin(vecReviews), end(vecReviews));
+        if(!byCard.empty())
+          vecRuns.push_back(byCard.size());
+        for(size_t k = 0; k < iKept; ++k)
+        {
+          Group g = { vecReviews[k].fScore, 1, vecReviews[k].fScore >= fPass };
+          if(k && vecReviews[k - 1].iCard == vecReviews[k].iCard)
+            byCard.back().second.add(g);
+          else
+            byCard.push_back(make_pair(vecReviews[k].iCard, g));
+        }
+        //a card's runs from different blocks are folded now and then
+        if(byCard.size() > 2 * iFolded + kBlock)
+        {
+          fold(byCard, vecRuns);
+          iFolded = byCard.size();
+        }
+      }
+      fold(byCard, vecRuns);
+      sort(begin(byDeck), end(byDeck),
+        [](const pair<uint64_t, Group>& a, const pair<uint64_t, Group>& b)
+        {
+          return a.first < b.first;
+        });
+      fclose(pCard);
+      fclose(pDeck);
+      fclose(pTime);
+      fclose(pScore);
+    }));
+  }
+  for(auto w = begin(vWorkers); w != end(vWorkers); ++w)
+    w->join();
+
+  vector<size_t> vecCardRuns(1, 0);
+  vector<size_t> vecDeckRuns(1, 0);
+  for(uint32_t t = 1; t < iThreads; ++t)
+  {
+    vecCardRuns.push_back(vecByCard[0].size());
+    vecByCard[0].insert(end(vecByCard[0]), begin(vecByCard[t]), end(vecByCard[t]));
+    Groups().swap(vecByCard[t]);
+    vecDeckRuns.push_back(vecByDeck[0].size());
+    vecByDeck[0].insert(end(vecByDeck[0]), begin(vecByDeck[t]), end(vecByDeck[t]));
+    for(size_t w = 0; w < vecByWeek[0].size(); ++w)
+      vecByWeek[0][w].add(vecByWeek[t][w]);
+  }
+  Groups& byCard = vecByCard[0];
+  Groups& byDeck = vecByDeck[0];
+  const vector<Group>& byWeek = vecByWeek[0];
+  fold(byCard, vecCardRuns);
+  fold(byDeck, vecDeckRuns);
+
+  //names for card and deck ids
+  unordered_map<uint64_t, string> mapQuestions;
+  if(ProgramOptions::szDeck)
+  {
+    File deck(ProgramOptions::szDeck, "r");
+    Parser parser(&deck);
+    vector<QA> vQAs;
+    parser.read_deck(vQAs);
+    for(auto qa = begin(vQAs); qa != end(vQAs); ++qa)
+    {
+      mapQuestions[ReviewLog::card_id(qa->question)] = qa->question;
+      //reviews carried over from a 32-bit .card
+      mapQuestions[ReviewLog::card_id(qa->question, true)] = qa->question;
+    }
+  }
+  unordered_map<uint32_t, string> mapDecks;
+  FILE * pNames = fopen((strPrefix + ".decks").c_str(), "r");
+  if(pNames)
+  {
+    char line[512];
+    while(fgets(line, sizeof(line), pNames))
+    {
+      char * szName = strchr(line, ' ');
+      if(!szName)
+        continue;
+      szName[strcspn(szName, "\n")] = 0;
+      mapDecks[strtoul(line, NULL, 16)] = szName + 1;
+    }
+    fclose(pNames);
+  }
+
+  vector<pair<float, size_t>> vecHardest; //(mean score, index in byCard)
+  for(size_t i = 0; i < byCard.size(); ++i)
+  {
+    const Group& g = byCard[i].second;
+    if(g.iReviews >= ProgramOptions::iStatsMinReviews)
+      vecHardest.push_back(make_pair(g.fScore / g.iReviews, i));
+  }
+  size_t iTop = min((size_t) ProgramOptions::iStatsTop, vecHardest.size());
+  partial_sort(begin(vecHardest), begin(vecHardest) + iTop, end(vecHardest));
+
+  cout << "Hardest " << iTop << " cards";
+  if(iSince)
+    cout << " over the last " << ProgramOptions::iStatsDays << " days";
+  cout << ":\n";
+  for(size_t i = 0; i < iTop; ++i)
+  {
+    uint64_t iCard = byCard[vecHardest[i].second].first;
+    const Group& g = byCard[vecHardest[i].second].second;
+    auto name = mapQuestions.find(iCard);
+    printf("  %5.1f%%  %4u reviews  ", vecHardest[i].first * 100, g.iReviews);
+    if(name != end(mapQuestions))
+      cout << name->second << "\n";
+    else
+      printf("card %016llx\n", (unsigned long long) iCard);
+  }
+
+  cout << "\nRetention by deck (score >= " << fPass * 100 << "%):\n";
+  for(auto g = begin(byDeck); g != end(byDeck); ++g)
+  {
+    auto name = mapDecks.find((uint32_t) g->first);
+    printf("  %5.1f%%  %8u reviews  ",
+      100.0 * g->second.iPassed / g->second.iReviews, g->second.iReviews);
+    if(name != end(mapDecks))
+      cout << name->second << "\n";
+    else
+      printf("deck %08x\n", (unsigned) g->first);
+  }
+
+  cout << "\nRetention by week:\n";
+  for(size_t w = 0; w < byWeek.size(); ++w)
+  {
+    const Group& g = byWeek[w];
+    if(!g.iReviews)
+      continue;
+    time_t tWeek = (time_t) w * kWeek;
+    char szDate[16];
+    strftime(szDate, sizeof(szDate), "%Y-%m-%d", gmtime(&tWeek));
+    printf("  %s  %5.1f%%  %8u reviews\n", szDate,
+      100.0 * g.iPassed / g.iReviews, g.iReviews);
+  }
+}
+
+void Prompt::read_live
+(
+  string& strLine
+)
+/*
+  Reads an answer a keystroke at a time, showing the running
+  match count after the cursor. Only the word being edited is
+  looked up again on each key, against the answer's word table
+  built in AnswerHandler::exec(), so feedback costs the same
+  however long the answer is. The total equals what
+  compare_words() gives for the finished line.
+*/
+{
+  RawTerminal term;
+  if(!term.active())
+  {
+    getline(cin, strLine);
+    return;
+  }
+
+  strLine.clear();
+  size_t iWordStart = 0;
+  uint32_t iMatches = 0;
+  float fMatched = 0.0f;
+  float fTotal = 0.0f;
+  for(auto w = begin(ah.vecWeights); w != end(ah.vecWeights); ++w)
+    fTotal += *w;
+
+  //contribution of one given word: every real word it equals
+  auto credit = [&](const string& strWord, int sign)
+  {
+    auto found = ah.mapWordMatches.find(strWord);
+    if(found == end(ah.mapWordMatches))
+      return;
+    iMatches += sign * found->second.iCount;
+    fMatched += sign * found->second.fWeight;
+  };
+  auto status = [&]()
+  {
+    cout << "\0337\033[K   [" << iMatches << "/" << ah.lstWords.size();
+    if(fTotal > 0.0f)
+      cout << " " << (int)(100 * fMatched / fTotal) << "%";
+    cout << "]\0338" << flush;
+  };
+
+  credit(strLine.substr(iWordStart), 1);
+  status();
+  for(;;)
+  {
+    int c = term.get();
+    if(c == EOF || c == '\n' || c == '\r' || c == 0x04)
+      break;
+    if(c == 0x03)
+    {
+      term.restore();
+      cout << "\n";
+      raise(SIGINT);
+      return;
+    }
+    if(c == 0x1b)
+    {
+      //arrow keys and the like: ESC [ x
+      if(term.get() == '[')
+        term.get();
+      continue;
+    }
+
+    string strWord(strLine, iWordStart);
+    if(c == 0x7f || c == '\b')
+    {
+      if(strLine.empty())
+        continue;
+      credit(strWord, -1);
+      if(iWordStart == strLine.size())
+      {
+        //joining with the previous word
+        strLine.erase(strLine.size() - 1);
+        iWordStart = strLine.rfind(' ');
+        iWordStart = iWordStart == string::npos ? 0 : iWordStart + 1;
+        credit(strLine.substr(iWordStart), -1);
+      }
+      else
+      {
+        size_t iErase = strLine.size() - 1;
+        while(iErase > iWordStart && (strLine[iErase] & 0xc0) == 0x80)
+          --iErase;
+        strLine.erase(iErase);
+      }
+      credit(strLine.substr(iWordStart), 1);
+      cout << "\b \b";
+      status();
+      continue;
+    }
+    if(c < 0x20)
+      continue;
+
+    strLine.append(1, (char) c);
+    if(c == ' ')
+    {
+      iWordStart = strLine.size();
+      credit(string(), 1);
+    }
+    else
+    {
+      credit(strWord, -1);
+      strWord.append(1, (char) c);
+      credit(strWord, 1);
+    }
+    cout << (char) c;
+    if((c & 0xc0) != 0x80)
+      status();
+  }
+  cout << "\033[K\n";
+}
+
+void PrefixIndex::put_varint
+(
+  string& strDest,
+  uint32_t i
+)
+{
+  while(i >= 0x80)
+  {
+    strDest.append(1, (char) (i | 0x80));
+    i >>= 7;
+  }
+  strDest.append(1, (char) i);
+}
+
+uint32_t PrefixIndex::get_varint
+(
+  const char *& p
+)
+{
+  uint32_t ret = 0;
+  for(int shift = 0; ; shift += 7)
+  {
+    uint8_t b = *p++;
+    ret |= (uint32_t) (b & 0x7f) << shift;
+    if(!(b & 0x80))
+      return ret;
+  }
+}
+
+void PrefixIndex::build
+(
+  vector<string>& vecWords
+)
+/*
+  Consumes `vecWords`
+*/
+{
+  sort(begin(vecWords), end(vecWords));
+  vecUses.clear();
+  size_t iDistinct = 0;
+  for(size_t i = 0; i < vecWords.size(); ++i)
+  {
+    if(iDistinct && vecWords[i] == vecWords[iDistinct - 1])
+    {
+      vecUses.back() += 1;
+      continue;
+    }
+    vecUses.push_back(1);
+    if(iDistinct != i)
+      vecWords[iDistinct].swap(vecWords[i]);
+    ++iDistinct;
+  }
+  vecWords.resize(iDistinct);
+
+  strPool.clear();
+  vecBlocks.clear();
+  setGone.clear();
+  mapAdded.clear();
+  built = true;
+  iSize = vecWords.size();
+  for(size_t i = 0; i < vecWords.size(); ++i)
+  {
+    const string& strWord = vecWords[i];
+    if(i % kiBlock == 0)
+    {
+      vecBlocks.push_back(strPool.size());
+      put_varint(strPool, strWord.size());
+      strPool.append(strWord);
+      continue;
+    }
+    const string& strPrev = vecWords[i - 1];
+    size_t iShared = 0;
+    while(iShared < strPrev.size() && iShared < strWord.size()
+      && strPrev[iShared] == strWord[iShared])
+    {
+      ++iShared;
+    }
+    put_varint(strPool, iShared);
+    put_varint(strPool, strWord.size() - iShared);
+    strPool.append(strWord, iShared, string::npos);
+  }
+  strPool.shrink_to_fit();
+  vecBlocks.shrink_to_fit();
+  vecUses.shrink_to_fit();
+  vector<string>().swap(vecWords);
+}
+
+bool PrefixIndex::find
+(
+  const string& strWord,
+  size_t * piRank
+) const
+/*
+  Whether the pool holds strWord, at rank `*piRank`
+*/
+{
+  *piRank = lower_bound(strWord);
+  if(*piRank >= iSize)
+    return false;
+  const char * p = strPool.data() + vecBlocks[*piRank / kiBlock];
+  uint32_t iLen = get_varint(p);
+  string strFound(p, iLen);
+  p += iLen;
+  for(size_t r = *piRank / kiBlock * kiBlock; r < *piRank; ++r)
+  {
+    uint32_t iShared = get_varint(p);
+    uint32_t iSuffix = get_varint(p);
+    strFound.erase(iShared);
+    strFound.append(p, iSuffix);
+    p += iSuffix;
+  }
+  return strFound == strWord;
+}
+
+void PrefixIndex::add
+(
+  const string& strWord
+)
+{
+  size_t iRank;
+  if(!find(strWord, &iRank))
+    mapAdded[strWord] += 1;
+  else if(vecUses[iRank]++ == 0)
+    setGone.erase(iRank);
+}
+
+void PrefixIndex::remove
+(
+  const string& strWord
+)
+{
+  size_t iRank;
+  if(find(strWord, &iRank))
+  {
+    if(vecUses[iRank] && --vecUses[iRank] == 0)
+      setGone.insert(iRank);
+    return;
+  }
+  auto added = mapAdded.find(strWord);
+  if(added != end(mapAdded) && --added->second == 0)
+    mapAdded.erase(added);
+}
+
+size_t PrefixIndex::lower_bound
+(
+  const string& strKey
+) const
+/*
+  Rank of the first word >= strKey
+*/
+{
+  //last block whose head is <= strKey
+  size_t lo = 0;
+  size_t hi = vecBlocks.size();
+  while(lo < hi)
+  {
+    size_t mid = (lo + hi) / 2;
+    const char * p = strPool.data() + vecBlocks[mid];
+    uint32_t iLen = get_varint(p);
+    if(strKey.compare(0, string::npos, p, iLen) < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  if(lo == 0)
+    return 0;
+  size_t iBlock = lo - 1;
+
+  const char * p = strPool.data() + vecBlocks[iBlock];
+  const char * pEnd = iBlock + 1 < vecBlocks.size() ?
+    strPool.data() + vecBlocks[iBlock + 1] : strPool.data() + strPool.size();
+  uint32_t iLen = get_varint(p);
+  string strWord(p, iLen);
+  p += iLen;
+  size_t iRank = iBlock * kiBlock;
+  while(strWord < strKey)
+  {
+    ++iRank;
+    if(p == pEnd)
+      break;
+    uint32_t iShared = get_varint(p);
+    uint32_t iSuffix = get_varint(p);
+    strWord.erase(iShared);
+    strWord.append(p, iSuffix);
+    p += iSuffix;
+  }
+  return iRank;
+}
+
+size_t PrefixIndex::count
+(
+  const string& strPrefix
+) const
+{
+  size_t iFrom = lower_bound(strPrefix);
+  size_t iTo = iSize;
+  //the smallest string greater than every word with this prefix
+  string strPast(strPrefix);
+  while(!strPast.empty() && (uint8_t) strPast.back() == 0xff)
+    strPast.erase(strPast.size() - 1);
+  if(!strPast.empty())
+  {
+    strPast.back() += 1;
+    iTo = lower_bound(strPast);
+  }
+  size_t iCount = iTo - iFrom;
+  for(auto g = setGone.lower_bound(iFrom); g != end(setGone) && *g < iTo; ++g)
+    --iCount;
+  for(auto a = mapAdded.lower_bound(strPrefix); a != end(mapAdded)
+    && !a->first.compare(0, strPrefix.size(), strPrefix); ++a)
+  {
+    ++iCount;
+  }
+  return iCount;
+}
+
+void PrefixIndex::complete
+(
+  const string& strPrefix,
+  size_t iMax,
+  vector<string>& vecDest
+) const
+{
+  //words added since the build, merged in order
+  auto added = mapAdded.lower_bound(strPrefix);
+  auto take_added = [&](const string * pBefore)
+  {
+    while(vecDest.size() < iMax && added != end(mapAdded)
+      && !added->first.compare(0, strPrefix.size(), strPrefix)
+      && (!pBefore || added->first < *pBefore))
+    {
+      vecDest.push_back(added->first);
+      ++added;
+    }
+  };
+
+  size_t iRank = lower_bound(strPrefix);
+  if(iRank >= iSize)
+  {
+    take_added(NULL);
+    return;
+  }
+  size_t iBlock = iRank / kiBlock;
+  const char * p = strPool.data() + vecBlocks[iBlock];
+  uint32_t iLen = get_varint(p);
+  string strWord(p, iLen);
+  p += iLen;
+  for(size_t r = iBlock * kiBlock; r < iSize && vecDest.size() < iMax; ++r)
+  {
+    if(r % kiBlock == 0 && r != iBlock * kiBlock)
+    {
+      p = strPool.data() + vecBlocks[r / kiBlock];
+      iLen = get_varint(p);
+      strWord.assign(p, iLen);
+      p += iLen;
+    }
+    else if(r != iBlock * kiBlock)
+    {
+      uint32_t iShared = get_varint(p);
+      uint32_t iSuffix = get_varint(p);
+      strWord.erase(iShared);
+      strWord.append(p, iSuffix);
+      p += iSuffix;
+    }
+    if(r < iRank)
+      continue;
+    if(strWord.compare(0, strPrefix.size(), strPrefix))
+      break;
+    take_added(&strWord);
+    if(vecDest.size() < iMax && !setGone.count(r))
+      vecDest.push_back(strWord);
+  }
+  take_added(NULL);
+}
+
+bool Prompt::hint
+(
+  const string& strInput,
+  const vector<string>& vecTargets,
+  uint16_t * piLevel
+)
+/*
+  "?prefix" lists deck words starting with prefix;
+  "??" reveals one more letter of each of `vecTargets`,
+  with how many deck words share what is revealed.
+  "???" is left to the prompts.
+
+  Returns: whether the input was a hint request
+*/
+{
+  if(strInput.empty() || strInput[0] != '?' || strInput == "???")
+    return false;
+
+  if(!hints.ready())
+  {
+    //built on first use, so sessions without hints pay nothing
+    vector<QA> vDeck;
+    parser.read_deck(vDeck);
+    vector<string> vecWords;
+    for(auto qa = begin(vDeck); qa != end(vDeck); ++qa)
+      hint_words(qa->answer, vecWords);
+    hints.build(vecWords);
+  }
+
+  if(strInput == "??")
+  {
+    *piLevel += 1;
+    for(auto t = begin(vecTargets); t != end(vecTargets); ++t)
+    {
+      size_t iShown = min((size_t) *piLevel, t->size());
+      string strShown(*t, 0, iShown);
+      cout << "  " << strShown << string(t->size() - iShown, '_')
+        << "  (" << hints.count(strShown) << " deck words)\n";
+    }
+    return true;
+  }
+
+  static const size_t kiCompletions = 10;
+  string strPrefix(strInput, 1);
+  vector<string> vecFound;
+  hints.complete(strPrefix, kiCompletions, vecFound);
+  for(auto w = begin(vecFound); w != end(vecFound); ++w)
+    cout << "  " << *w << "\n";
+  size_t iTotal = hints.count(strPrefix);
+  if(iTotal > vecFound.size())
+    cout << "  ... " << iTotal - vecFound.size() << " more\n";
+  if(!iTotal)
+    cout << "  no deck words start with \"" << strPrefix << "\"\n";
+  return true;
+}
+
+void Prompt::hint_words
+(
+  const string& strAnswer,
+  vector<string>& vecDest
+)
+/*
+  Appends the words and items of an answer as hints know them
+*/
+{
+  size_t iFirst = strAnswer.find_first_not_of(' ');
+  if(iFirst == string::npos)
+    return;
+  if(strAnswer[iFirst] == '{')
+  {
+    AnswerHandler scratch;
+    scratch.strAnswer = strAnswer;
+    scratch.construct_list();
+    vecDest.insert(end(vecDest),
+      begin(scratch.vecListItems), end(scratch.vecListItems));
+  }
+  else if(strAnswer[iFirst] == '[')
+  {
+    AnswerHandler::split_sequence(strAnswer, vecDest);
+  }
+  else
+  {
+    std::list<string> lstWords;
+    AnswerHandler::load_words(lstWords, strAnswer);
+    for(auto w = begin(lstWords); w != end(lstWords); ++w)
+    {
+      if(!w->empty())
+        vecDest.push_back(*w);
+    }
+  }
+}
+
+bool Prompt::edit
+(
+  const string& strInput,
+  QA * qa
+)
+/*
+  "!edit" asks for the card's new question and answer, in
+  deck syntax without the delimiter; an empty line keeps the
+  old one. The deck is patched where the card is when the new
+  text fits, else the card moves to the end of the deck.
+
+  Returns: whether the input was the command
+*/
+{
+  if(strInput != "!edit")
+    return false;
+
+  string strQuestionShown(qa->question);
+  strQuestionShown.erase(strQuestionShown.find_last_not_of("\r\n") + 1);
+  string strAnswerShown(qa->answer);
+  strAnswerShown.erase(strAnswerShown.find_last_not_of("\r\n") + 1);
+  string strQuestion;
+  string strAnswer;
+  cout << "  question [" << strQuestionShown << "]: ";
+  getline(cin, strQuestion);
+  cout << "  answer [" << strAnswerShown << "]: ";
+  getline(cin, strAnswer);
+  edited = true;
+  if(strQuestion.empty() && strAnswer.empty())
+    return true;
+  if(!strAnswer.empty()
+    && sflash_answer_kind(strAnswer.data(), strAnswer.size()) == SFLASH_EMPTY)
+  {
+    cout << "  empty answer, card left as it was\n";
+    return true;
+  }
+
+  uint64_t iLine = posCurrent.iLine;
+  long iOffset = parser.file->rewrite(posCurrent.iOffset,
+    strQuestion.empty() ? NULL : &strQuestion,
+    strAnswer.empty() ? NULL : &strAnswer, ProgramOptions::pDialect, &iLine);
+  if(iOffset < 0)
+    return true;
+
+  parser.cache.erase(posCurrent.iOffset);
+  parser.forget();
+  answers.update(posCurrent.iCard, iOffset, qa->answer,
+    strAnswer.empty() ? qa->answer : strAnswer + "\n");
+  if(!strQuestion.empty())
+    qa->question = Parser::unescape(strQuestion) + "\n";
+  if(!strAnswer.empty())
+  {
+    if(hints.ready())
+    {
+      //the old card's words out, the new ones in
+      vector<string> vecWords;
+      hint_words(qa->answer, vecWords);
+      for(auto w = begin(vecWords); w != end(vecWords); ++w)
+        hints.remove(*w);
+      vecWords.clear();
+      hint_words(strAnswer + "\n", vecWords);
+      for(auto w = begin(vecWords); w != end(vecWords); ++w)
+        hints.add(*w);
+    }
+    qa->answer = strAnswer + "\n";
+    if(parser.pWeights)
+      parser.pWeights->weigh(*qa);
+  }
+  cout << (iOffset == posCurrent.iOffset ? "  saved in place\n" :
+    "  saved at the end of the deck\n");
+  posCurrent.iOffset = iOffset;
+  posCurrent.iLine = iLine;
+  posCurrent.iCard = iOffset;
+  checkpoint.at(posCurrent);
+  checkpoint.deck_changed();
+  return true;
+}
+
+Checker::Checker
+(
+  const char * szPath_
+)
+{
+  szPath = szPath_;
+  FILE * pFile = fopen(szPath, "rb");
+  if(!pFile)
+  {
+    puts("File not found error");
+    exit(1);
+  }
+  fseek(pFile, 0, SEEK_END);
+  iSize = ftell(pFile);
+  fclose(pFile);
+}
+
+void Checker::check_braces
+(
+  const char * pText,
+  size_t iLen,
+  size_t iColumn,
+  uint64_t iLine,
+  vector<Error>& vecDest
+)
+/*
+  `iColumn` is the column of pText[0]
+*/
+{
+  size_t iOpen = 0;
+  uint32_t iDepth = 0;
+  for(size_t i = 0; i < iLen; ++i)
+  {
+    switch(pText[i])
+    {
+      case '\\':
+      {
+        if(i + 1 < iLen && sflash_escapable(pText[i + 1]))
+          ++i;
+        break;
+      }
+      case '{':
+      {
+        if(iDepth)
+          vecDest.push_back(Error{iLine, (uint32_t) (iColumn + i), "nested '{'"});
+        else
+          iOpen = i;
+        iDepth += 1;
+        break;
+      }
+      case '}':
+      {
+        if(!iDepth)
+          vecDest.push_back(Error{iLine, (uint32_t) (iColumn + i), "unmatched '}'"});
+        else
+          iDepth -= 1;
+        break;
+      }
+      default:
+        break;
+    }
+  }
+  if(iDepth)
+    vecDest.push_back(Error{iLine, (uint32_t) (iColumn + iOpen), "unclosed '{'"});
+}
+
+void Checker::check_line
+(
+  const char * pLine,
+  size_t iLen,
+  Chunk& chunk
+)
+/*
+  `pLine` holds no line ending; chunk.iLines is its
+  line number within the chunk
+*/
+{
+  size_t iText = 0;
+  sflash_line kind = sflash_line_kind(ProgramOptions::pDialect, pLine, iLen, &iText);
+  if(kind == SFLASH_LINE_OTHER)
+    return;
+
+  //errors point at the marker
+  uint32_t iColumn = 1;
+  while(pLine[iColumn - 1] == ' ' || pLine[iColumn - 1] == '\t')
+    ++iColumn;
+  Error here{chunk.iLines, iColumn, NULL};
+  const char * pText = pLine + iText;
+  size_t iTextLen = iLen - iText;
+
+  if(chunk.first == SFLASH_LINE_OTHER)
+  {
+    chunk.first = kind;
+    chunk.errFirst = here;
+  }
+  else if(kind == SFLASH_LINE_QUESTION && chunk.open)
+    chunk.vecErrors.push_back(chunk.errOpen);
+  else if(kind == SFLASH_LINE_ANSWER && !chunk.open)
+  {
+    here.szMessage = "unmatched question/answer pair: answer has no question";
+    chunk.vecErrors.push_back(here);
+  }
+
+  if(kind == SFLASH_LINE_QUESTION)
+  {
+    size_t iBlank = 0;
+    while(iBlank < iTextLen && isspace((unsigned char) pText[iBlank]))
+      ++iBlank;
+    if(iBlank == iTextLen)
+      chunk.vecErrors.push_back(Error{chunk.iLines, iColumn, "empty question"});
+    chunk.open = true;
+    chunk.errOpen = Error{chunk.iLines, iColumn,
+      "unmatched question/answer pair: question has no answer"};
+  }
+  else
+  {
+    if(chunk.open)
+      chunk.iCards += 1;
+    if(sflash_answer_kind(pText, iTextLen) == SFLASH_EMPTY)
+      chunk.vecErrors.push_back(Error{chunk.iLines, iColumn, "empty answer"});
+    check_braces(pText, iTextLen, iText + 1, chunk.iLines, chunk.vecErrors);
+    chunk.open = false;
+  }
+}
+
+void Checker::check_chunk
+(
+  uint64_t iFrom,
+  uint64_t iTo,
+  Chunk& chunk
+)
+/*
+  Checks the lines that start in [iFrom, iTo)
+*/
+{
+  chunk.iLines = 0;
+  chunk.iCards = 0;
+  chunk.first = SFLASH_LINE_OTHER;
+  chunk.open = false;
+  if(iFrom >= iTo)
+    return;
+
+  FILE * pFile = fopen(szPath, "rb");
+  if(!pFile)
+  {
+    puts("File not found error");
+    exit(1);
+  }
+  //from one byte back, so a line starting exactly at iFrom is not skipped
+  uint64_t iBase = iFrom ? iFrom - 1 : 0;
+  bool skip = iFrom != 0;
+  fseek(pFile, iBase, SEEK_SET);
+
+  vector<char> vecBuf;
+  size_t iCarry = 0;
+  for(;;)
+  {
+    vecBuf.resize(iCarry + File::kiBlock);
+    size_t iRead = fread(vecBuf.data() + iCarry, 1, File::kiBlock, pFile);
+    size_t iLen = iCarry + iRead;
+    bool at_end = iRead < File::kiBlock;
+    const char * pBuf = vecBuf.data();
+
+    size_t iLineStart = 0;
+    while(iLineStart < iLen)
+    {
+      const char * pEnd = (const char *) memchr(pBuf + iLineStart, '\n',
+        iLen - iLineStart);
+      if(!pEnd && !at_end)
+        break;
+      size_t iLineEnd = pEnd ? pEnd - pBuf : iLen;
+      if(skip)
+        skip = false;
+      else
+      {
+        if(iBase + iLineStart >= iTo)
+        {
+          fclose(pFile);
+          return;
+        }
+        size_t iTrimmed = iLineEnd;
+        if(iTrimmed > iLineStart && pBuf[iTrimmed - 1] == '\r')
+          --iTrimmed;
+        chunk.iLines += 1;
+        check_line(pBuf + iLineStart, iTrimmed - iLineStart, chunk);
+      }
+      iLineStart = iLineEnd + 1;
+    }
+
+    if(at_end)
+      break;
+    iCarry = iLen - iLineStart;
+    memmove(vecBuf.data(), pBuf + iLineStart, iCarry);
+    iBase += iLineStart;
+  }
+  fclose(pFile);
+}
+
+bool Checker::report()
+/*
+  Prints every error as file:line:column: message
+
+  Returns: true when the deck is valid
+*/
+{
+  uint32_t iThreads = thread_count();
+  size_t iChunks = iThreads * 4;
+  uint64_t iPer = iSize / iChunks + 1;
+  vector<Chunk> vecChunks(iChunks);
+
+  atomic<size_t> iNext(0);
+  vector<thread> vWorkers;
+  for(uint32_t t = 0; t < iThreads; ++t)
+  {
+    vWorkers.push_back(thread([&]()
+    {
+      size_t c;
+      while((c = iNext++) < iChunks)
+      {
+        uint64_t iFrom = min(iSize, c * iPer);
+        check_chunk(iFrom, min(iSize, iFrom + iPer), vecChunks[c]);
+      }
+    }));
+  }
+  for(auto w = begin(vWorkers); w != end(vWorkers); ++w)
+    w->join();
+
+  //stitch the chunks together: shift line numbers and
+  //settle each chunk's first card line against the open state
+  vector<Error> vecErrors;
+  uint64_t iLinesBefore = 0;
+  uint64_t iCards = 0;
+  bool open = false;
+  Error errOpen;
+  for(auto chunk = begin(vecChunks); chunk != end(vecChunks); ++chunk)
+  {
+    for(auto e = begin(chunk->vecErrors); e != end(chunk->vecErrors); ++e)
+    {
+      vecErrors.push_back(*e);
+      vecErrors.back().iLine += iLinesBefore;
+    }
+    iCards += chunk->iCards;
+    if(chunk->first == SFLASH_LINE_QUESTION && open)
+      vecErrors.push_back(errOpen);
+    else if(chunk->first == SFLASH_LINE_ANSWER)
+    {
+      if(open)
+        iCards += 1;
+      else
+      {
+        Error here = chunk->errFirst;
+        here.iLine += iLinesBefore;
+        here.szMessage = "unmatched question/answer pair: answer has no question";
+        vecErrors.push_back(here);
+      }
+    }
+    if(chunk->first != SFLASH_LINE_OTHER)
+    {
+      open = chunk->open;
+      errOpen = chunk->errOpen;
+      errOpen.iLine += iLinesBefore;
+    }
+    iLinesBefore += chunk->iLines;
+  }
+  if(open)
+    vecErrors.push_back(errOpen);
+
+  sort(begin(vecErrors), end(vecErrors));
+  for(auto e = begin(vecErrors); e != end(vecErrors); ++e)
+  {
+    cout << szPath << ":" << e->iLine << ":" << e->iColumn
+      << ": error: " << e->szMessage << "\n";
+  }
+  cout << szPath << ": " << iCards << " cards, " << iLinesBefore
+    << " lines, " << vecErrors.size() << " errors\n";
+  return vecErrors.empty();
+}
+
+Checkpoint * Checkpoint::pInstance = NULL;
+
+void Checkpoint::open
+(
+  const char * szPath,
+  File * pFile_
+)
+/*
+  Loads the checkpoint at `szPath` if it exists and was
+  made for the deck as it is now
+*/
+{
+  strPath = szPath;
+  strTemp = strPath + ".tmp";
+  pFile = pFile_;
+  used = true;
+
+  struct stat st;
+  iDeckSize = 0;
+  iDeckTime = 0;
+  if(!stat(ProgramOptions::szDeck, &st))
+  {
+    iDeckSize = st.st_size;
+    iDeckTime = st.st_mtime;
+  }
+
+  loaded = load();
+  build();
+  pInstance = this;
+  signal(SIGINT, &Checkpoint::on_interrupt);
+}
+
+Checkpoint::~Checkpoint()
+{
+  if(!used)
+    return;
+  pInstance = NULL;
+  signal(SIGINT, SIG_DFL);
+}
+
+bool Checkpoint::load()
+{
+  FILE * pIn = fopen(strPath.c_str(), "rb");
+  if(!pIn)
+    return false;
+
+  bool ok = true;
+  auto take = [&](void * pDest, size_t iBytes)
+  {
+    ok = ok && fread(pDest, 1, iBytes, pIn) == iBytes;
+  };
+  char magic[4] = {0};
+  uint32_t iVersion = 0;
+  uint64_t iSize = 0;
+  int64_t iTime = 0;
+  take(magic, sizeof(magic));
+  take(&iVersion, sizeof(iVersion));
+  take(&iSize, sizeof(iSize));
+  take(&iTime, sizeof(iTime));
+  if(!ok || memcmp(magic, "SFCP", 4) || iVersion != kiVersion
+    || iSize != iDeckSize || iTime != iDeckTime)
+  {
+    fclose(pIn);
+    cout << "Checkpoint " << strPath << " does not match this deck, "
+      "starting over\n";
+    return false;
+  }
+
+  Parser::CardPos pos;
+  uint64_t iRandomState = 0;
+  uint64_t iLineCount = 0;
+  uint64_t iMarks = 0;
+  uint64_t iWords = 0;
+  uint64_t iItems = 0;
+  int64_t iList = 0;
+  int64_t iOffset = 0;
+  take(&iOffset, sizeof(iOffset));
+  take(&pos.iLine, sizeof(pos.iLine));
+  take(&iRandomState, sizeof(iRandomState));
+  take(&iLineCount, sizeof(iLineCount));
+  take(&iMarks, sizeof(iMarks));
+  vector<int64_t> vecMarks(ok && iMarks <= iSize / File::kiLineMark + 1 ? iMarks : 0);
+  take(vecMarks.data(), vecMarks.size() * sizeof(int64_t));
+  take(&iWords, sizeof(iWords));
+  vector<uint64_t> vecWords(ok && iWords <= iSize / (64 * kiSeenGrain) + 1 ?
+    iWords : 0);
+  take(vecWords.data(), vecWords.size() * sizeof(uint64_t));
+  take(&iList, sizeof(iList));
+  take(&iItems, sizeof(iItems));
+  vector<uint32_t> vecItems(ok && iItems <= iSize ? iItems : 0);
+  take(vecItems.data(), vecItems.size() * sizeof(uint32_t));
+  fclose(pIn);
+  if(!ok || vecMarks.size() != iMarks || vecWords.size() != iWords
+    || vecItems.size() != iItems)
+  {
+    cout << "Checkpoint " << strPath << " is damaged, starting over\n";
+    return false;
+  }
+
+  pos.iOffset = iOffset;
+  pos.iCard = iOffset;
+  posCurrent = pos;
+  pFile->seed(iRandomState);
+  if(iMarks)
+  {
+    pFile->iLineCount = iLineCount;
+    pFile->vecLineMarks.assign(begin(vecMarks), end(vecMarks));
+    pFile->counted = true;
+  }
+  vecSeen.swap(vecWords);
+  iSeen = 0;
+  for(auto w = begin(vecSeen); w != end(vecSeen); ++w)
+    iSeen += __builtin_popcountll(*w);
+  iListOffset = iList;
+  vecList.swap(vecItems);
+  return true;
+}
+
+bool Checkpoint::resume()
+/*
+  Moves the deck to the card being asked when the
+  checkpoint was written
+*/
+{
+  if(!used || !loaded)
+    return false;
+  pFile->seek(posCurrent.iOffset, posCurrent.iLine);
+  cout << "Resuming at line " << posCurrent.iLine + 1 << ", "
+    << iSeen << " cards seen\n";
+  return true;
+}
+
+void Checkpoint::at
+(
+  const Parser::CardPos& pos,
+  bool batch
+)
+/*
+  `batch` for the first card of a batch, which is always saved
+*/
+{
+  posCurrent = pos;
+  if(pos.iOffset != iListOffset)
+  {
+    vecList.clear();
+    iListOffset = pos.iOffset;
+  }
+  if(batch)
+    build();
+  else
+    build_due();
+  patch_position();
+}
+
+void Checkpoint::list_progress
+(
+  const vector<uint32_t>& vecGiven
+)
+{
+  vecList = vecGiven;
+  iListOffset = posCurrent.iOffset;
+  build_due();
+}
+
+void Checkpoint::mark_seen
+(
+  long iCard
+)
+/*
+  The current card, whose question line starts at `iCard`, is
+  done: its list progress goes too
+*/
+{
+  vecList.clear();
+  iListOffset = -1;
+
+  uint64_t iBitAt = iCard / kiSeenGrain;
+  if(iBitAt / 64 >= vecSeen.size())
+    vecSeen.resize(iBitAt / 64 + 1, 0);
+  uint64_t iBit = (uint64_t) 1 << (iBitAt % 64);
+  if(!(vecSeen[iBitAt / 64] & iBit))
+    iSeen += 1;
+  vecSeen[iBitAt / 64] |= iBit;
+}
+
+bool Checkpoint::seen
+(
+  long iCard
+) const
+{
+  uint64_t iBitAt = iCard / kiSeenGrain;
+  if(iBitAt / 64 >= vecSeen.size())
+    return false;
+  return vecSeen[iBitAt / 64] >> (iBitAt % 64) & 1;
+}
+
+void Checkpoint::clear_seen()
+{
+  vecSeen.clear();
+  iSeen = 0;
+}
+
+void Checkpoint::deck_changed()
+/*
+  After an edit, so the checkpoint still matches the deck
+*/
+{
+  if(!used)
+    return;
+  struct stat st;
+  if(!stat(ProgramOptions::szDeck, &st))
+  {
+    iDeckSize = st.st_size;
+    iDeckTime = st.st_mtime;
+  }
+  build();
+}
+
+void Checkpoint::finish()
+/*
+  The deck was gone through: the next run starts over
+*/
+{
+  if(!used)
+    return;
+  posCurrent.iOffset = 0;
+  posCurrent.iLine = 0;
+  posCurrent.iCard = 0;
+  clear_seen();
+  vecList.clear();
+  build();
+  write_image(strPath.c_str(), strTemp.c_str(), vecImages[iActive]);
+}
+
+void Checkpoint::build()
+/*
+  Serializes into the image the signal handler is not
+  looking at, then hands it over
+*/
+{
+  if(!used)
+    return;
+  vector<char>& vecImage = vecImages[!iActive];
+  vecImage.clear();
+  auto put = [&](const void * pSrc, size_t iBytes)
+  {
+    vecImage.insert(end(vecImage), (const char *) pSrc,
+      (const char *) pSrc + iBytes);
+  };
+
+  if(posCurrent.iLine == File::kiUnknownLine)
+    posCurrent.iLine = pFile->line_at(posCurrent.iOffset);
+  int64_t iOffset = posCurrent.iOffset;
+  uint64_t iLineCount = pFile->counted ? pFile->iLineCount : 0;
+  uint64_t iMarks = pFile->counted ? pFile->vecLineMarks.size() : 0;
+  uint64_t iWords = vecSeen.size();
+  int64_t iList = iListOffset;
+  uint64_t iItems = vecList.size();
+  uint32_t iVersion = kiVersion;
+  put("SFCP", 4);
+  put(&iVersion, sizeof(iVersion));
+  put(&iDeckSize, sizeof(iDeckSize));
+  put(&iDeckTime, sizeof(iDeckTime));
+  put(&iOffset, sizeof(iOffset));
+  put(&posCurrent.iLine, sizeof(posCurrent.iLine));
+  put(&pFile->iRandomState, sizeof(pFile->iRandomState));
+  put(&iLineCount, sizeof(iLineCount));
+  put(&iMarks, sizeof(iMarks));
+  for(uint64_t m = 0; m < iMarks; ++m)
+  {
+    int64_t iMark = pFile->vecLineMarks[m];
+    put(&iMark, sizeof(iMark));
+  }
+  put(&iWords, sizeof(iWords));
+  put(vecSeen.data(), iWords * sizeof(uint64_t));
+  put(&iList, sizeof(iList));
+  put(&iItems, sizeof(iItems));
+  put(vecList.data(), iItems * sizeof(uint32_t));
+
+  iActive = !iActive;
+  //both alike, for patch_position()
+  vecImages[!iActive] = vecImages[iActive];
+  iBuilt = time(NULL);
+}
+
+void Checkpoint::build_due()
+/*
+  Rebuilding copies the whole seen bitmap, so while reviewing
+  it is done at most every kiBuildSeconds
+*/
+{
+  if(time(NULL) - iBuilt >= kiBuildSeconds)
+    build();
+}
+
+void Checkpoint::patch_position()
+/*
+  Writes the current card into the image the signal handler
+  is not looking at, hands it over, then does the other
+*/
+{
+  if(!used)
+    return;
+  if(posCurrent.iLine == File::kiUnknownLine)
+    posCurrent.iLine = pFile->line_at(posCurrent.iOffset);
+  int64_t iOffset = posCurrent.iOffset;
+  for(int i = 0; i < 2; ++i)
+  {
+    vector<char>& vecImage = vecImages[!iActive];
+    memcpy(&vecImage[kiPositionAt], &iOffset, sizeof(iOffset));
+    memcpy(&vecImage[kiPositionAt + sizeof(iOffset)], &posCurrent.iLine,
+      sizeof(posCurrent.iLine));
+    iActive = !iActive;
+  }
+}
+
+bool Checkpoint::write_image
+(
+  const char * szPath,
+  const char * szTemp,
+  const vector<char>& vecImage
+)
+/*
+  Writes a temporary file and renames it over the old one,
+  so a checkpoint is either the previous one or complete.
+  Only async-signal-safe calls on POSIX.
+*/
+{
+#if defined(__unix__) || defined(__APPLE__)
+  int fd = ::open(szTemp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0)
+    return false;
+  size_t iDone = 0;
+  while(iDone < vecImage.size())
+  {
+    ssize_t iWritten = ::write(fd, vecImage.data() + iDone,
+      vecImage.size() - iDone);
+    if(iWritten <= 0)
+    {
+      close(fd);
+      return false;
+    }
+    iDone += iWritten;
+  }
+  fsync(fd);
+  close(fd);
+#else
+  FILE * pOut = fopen(szTemp, "wb");
+  if(!pOut)
+    return false;
+  bool ok = fwrite(vecImage.data(), 1, vecImage.size(), pOut) == vecImage.size();
+  ok = !fclose(pOut) && ok;
+  if(!ok)
+    return false;
+  remove(szPath);
+#endif
+  return !rename(szTemp, szPath);
+}
+
+void Checkpoint::on_interrupt
+(
+  int iSignal
+)
+{
+  if(pInstance)
+  {
+    write_image(pInstance->strPath.c_str(), pInstance->strTemp.c_str(),
+      pInstance->vecImages[pInstance->iActive]);
+  }
+  signal(iSignal, SIG_DFL);
+  raise(iSignal);
+}
+
+string AnswerIndex::plain
+(
+  const char * pText,
+  size_t iLen
+)
+/*
+  An answer as shown: unescaped, blanks and line end trimmed
+*/
+{
+  string ret = Parser::unescape(string(pText, iLen));
+  size_t iFirst = ret.find_first_not_of(" \t\r\n");
+  if(iFirst == string::npos)
+    return string();
+  size_t iLast = ret.find_last_not_of(" \t\r\n");
+  return ret.substr(iFirst, iLast - iFirst + 1);
+}
+
+void AnswerIndex::band_keys
+(
+  const string& strAnswer,
+  uint32_t * pKeys
+)
+{
+  uint32_t sig[kiBands * kiRows];
+  Deduper::signature(strAnswer, sig, kiBands * kiRows);
+  for(uint16_t b = 0; b < kiBands; ++b)
+  {
+    uint64_t key = b;
+    for(uint16_t r = 0; r < kiRows; ++r)
+      key = mix64(key ^ sig[b * kiRows + r]);
+    pKeys[b] = key >> 32;
+  }
+}
+
+void AnswerIndex::build
+(
+  Parser& parser
+)
+/*
+  Reads the deck once, keying kiBatch answers at a time
+  on all cores
+*/
+{
+  static const size_t kiBatch = 1 << 14;
+  pFile = fopen(ProgramOptions::szDeck, "rb");
+  pReader = pFile ? sflash_reader_open(pFile, ProgramOptions::pDialect) : NULL;
+  pOffsets = sflash_offsets_new();
+  if(!pReader || !pOffsets)
+  {
+    puts("Out of memory");
+    exit(1);
+  }
+
+  uint32_t iThreads = thread_count();
+  vector<thread> vWorkers;
+  vector<string> vecAnswers;
+  size_t iPending = 0;
+  size_t iCards = 0;
+  auto key_batch = [&]()
+  {
+    for(uint16_t b = 0; b < kiBands; ++b)
+      vecBands[b].resize(iCards + iPending);
+    size_t iPer = (iPending + iThreads - 1) / iThreads;
+    for(uint32_t t = 0; t < iThreads; ++t)
+    {
+      size_t iFrom = t * iPer;
+      size_t iTo = min(iPending, iFrom + iPer);
+      if(iFrom >= iTo)
+        break;
+      vWorkers.push_back(thread([this, &vecAnswers, iCards, iFrom, iTo]()
+      {
+        uint32_t keys[kiBands];
+        for(size_t i = iFrom; i < iTo; ++i)
+        {
+          band_keys(vecAnswers[i], keys);
+          for(uint16_t b = 0; b < kiBands; ++b)
+            vecBands[b][iCards + i] = (uint64_t) keys[b] << 32 | (iCards + i);
+        }
+      }));
+    }
+    for(auto w = begin(vWorkers); w != end(vWorkers); ++w)
+      w->join();
+    vWorkers.clear();
+    iCards += iPending;
+    iPending = 0;
+  };
+  parser.scan_deck([&](const sflash_card& card)
+  {
+    if(!sflash_offsets_push(pOffsets, card.offset))
+    {
+      puts("Out of memory");
+      exit(1);
+    }
+    if(iPending == vecAnswers.size())
+      vecAnswers.push_back(string());
+    vecAnswers[iPending++] = plain(card.answer, card.answer_len);
+    if(iPending == kiBatch)
+      key_batch();
+  });
+  key_batch();
+
+  atomic<uint16_t> iNext(0);
+  for(uint32_t t = 0; t < iThreads && t < kiBands; ++t)
+  {
+    vWorkers.push_back(thread([&]()
+    {
+      uint16_t b;
+      while((b = iNext++) < kiBands)
+        sort(begin(vecBands[b]), end(vecBands[b]));
+    }));
+  }
+  for(auto w = begin(vWorkers); w != end(vWorkers); ++w)
+    w->join();
+}
+
+void AnswerIndex::update
+(
+  uint64_t iOld,
+  uint64_t iNew,
+  const string& strOldAnswer,
+  const string& strNewAnswer
+)
+/*
+  After `!edit`: the card whose question line started at
+  `iOld`, now at `iNew`, is keyed by its new answer. A card
+  moved to the end of the deck is numbered anew, and its old
+  number is never offered again.
+*/
+{
+  if(!pOffsets)
+    return;
+  sflash_reader_drop(pReader);
+  size_t iCard = sflash_offsets_find(pOffsets, iOld);
+  if(iCard == sflash_offsets_count(pOffsets)
+    || sflash_offsets_get(pOffsets, iCard) != iOld)
+  {
+    return;
+  }
+
+  uint32_t keys[kiBands];
+  band_keys(plain(strOldAnswer.data(), strOldAnswer.size()), keys);
+  for(uint16_t b = 0; b < kiBands; ++b)
+  {
+    uint64_t iEntry = (uint64_t) keys[b] << 32 | iCard;
+    auto found = lower_bound(begin(vecBands[b]), end(vecBands[b]), iEntry);
+    if(found != end(vecBands[b]) && *found == iEntry)
+      vecBands[b].erase(found);
+  }
+  if(iNew != iOld)
+  {
+    if(!sflash_offsets_push(pOffsets, iNew))
+    {
+      puts("Out of memory");
+      exit(1);
+    }
+    setMoved.insert(iCard);
+    iCard = sflash_offsets_count(pOffsets) - 1;
+  }
+  band_keys(plain(strNewAnswer.data(), strNewAnswer.size()), keys);
+  for(uint16_t b = 0; b < kiBands; ++b)
+  {
+    uint64_t iEntry = (uint64_t) keys[b] << 32 | iCard;
+    vecBands[b].insert(upper_bound(begin(vecBands[b]), end(vecBands[b]), iEntry),
+      iEntry);
+  }
+}
+
+string AnswerIndex::answer
+(
+  uint32_t iCard
+)
+/*
+  As plain() gives it; empty for a card that cannot be read
+*/
+{
+  sflash_card card;
+  sflash_error err;
+  sflash_reader_seek(pReader, sflash_offsets_get(pOffsets, iCard), 0, 0);
+  if(sflash_reader_next(pReader, &card, &err) <= 0)
+    return string();
+  return plain(card.answer, card.answer_len);
+}
+
+void AnswerIndex::similar
+(
+  const string& strAnswer,
+  size_t iWanted,
+  vector<string>& vecDest
+)
+/*
+  Up to `iWanted` distinct answers unlike `strAnswer` but
+  sharing the most bands with it. Random cards make up for
+  a shortfall.
+*/
+{
+  size_t iCards = sflash_offsets_count(pOffsets);
+  uint32_t keys[kiBands];
+  band_keys(strAnswer, keys);
+
+  unordered_map<uint32_t, uint16_t> mapShared;
+  for(uint16_t b = 0; b < kiBands; ++b)
+  {
+    const vector<uint64_t>& vecBand = vecBands[b];
+    uint64_t iKey = (uint64_t) keys[b] << 32;
+    auto lo = lower_bound(begin(vecBand), end(vecBand), iKey);
+    //the band's last entry, as key + 1 << 32 would wrap for key 0xFFFFFFFF
+    auto hi = upper_bound(lo, end(vecBand), iKey | UINT32_MAX);
+    size_t iBucket = hi - lo;
+    if(!iBucket)
+      continue;
+    //start anywhere in a large bucket, so the same cards are not always picked
+    size_t iStart = rand() % iBucket;
+    for(size_t i = 0; i < iBucket && i < kiBucketScan; ++i)
+      mapShared[(uint32_t) lo[(iStart + i) % iBucket]] += 1;
+  }
+
+  vector<pair<uint16_t, uint32_t>> vecRanked;
+  for(auto c = begin(mapShared); c != end(mapShared); ++c)
+    vecRanked.push_back(make_pair(c->second, c->first));
+  sort(begin(vecRanked), end(vecRanked),
+    [](const pair<uint16_t, uint32_t>& a, const pair<uint16_t, uint32_t>& b)
+    {
+      return a.first > b.first;
+    });
+
+  auto offer = [&](uint32_t iCard)
+  {
+    if(setMoved.count(iCard))
+      return;
+    string strOption = answer(iCard);
+    if(strOption.empty() || strOption == strAnswer
+      || find(begin(vecDest), end(vecDest), strOption) != end(vecDest))
+    {
+      return;
+    }
+    vecDest.push_back(strOption);
+  };
+  for(auto c = begin(vecRanked); c != end(vecRanked) && vecDest.size() < iWanted; ++c)
+    offer(c->second);
+  for(size_t i = 0; i < 4 * iWanted && vecDest.size() < iWanted && iCards; ++i)
+    offer(rand() % iCards);
+}
+
+void Prompt::choice
+(
+  QA * qa
+)
+{
+  string strCorrect = AnswerIndex::plain(qa->answer.data(), qa->answer.size());
+  vector<string> vecOptions;
+  answers.similar(strCorrect, ProgramOptions::iChoices - 1, vecOptions);
+  size_t iCorrect = rand() % (vecOptions.size() + 1);
+  vecOptions.insert(begin(vecOptions) + iCorrect, strCorrect);
+
+  cout << "Q: " << qa->question << "\n";
+  for(size_t i = 0; i < vecOptions.size(); ++i)
+    cout << "  " << i + 1 << ") " << vecOptions[i] << "\n";
+
+  string strUserAnswer;
+  size_t iPicked = 0;
+attempt:
+  cout << "> ";
+  getline(cin, strUserAnswer);
+  if(edit(strUserAnswer, qa))
+    return;
+  iPicked = atoi(strUserAnswer.c_str());
+  if(iPicked < 1 || iPicked > vecOptions.size())
+  {
+    cout << "Pick 1 to " << vecOptions.size() << "\n";
+    goto attempt;
+  }
+
+  if(iPicked - 1 == iCorrect)
+    cout << "Correct\n";
+  else
+    cout << "No: " << iCorrect + 1 << ") " << strCorrect << "\n";
+  log.record(*qa, iPicked - 1 == iCorrect ? 1.0f : 0.0f);
 }
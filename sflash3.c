@@ -1,17 +1,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <assert.h>
 #include <stdint.h>
-
-#define DELIM_QUESTION '-'
-#define DELIM_ANSWER '+'
+#include "libsflash.h"
 
 typedef struct
 {
-  fpos_t * pQuestionPositions;
-  uint16_t iPositions;
-  uint16_t iCurrentPosition;
+  sflash_offsets * pQuestionPositions; //compressed, ~1-2 bytes per card
+  size_t iCurrentPosition;
 } PositionsT;
 
 typedef struct
@@ -20,41 +16,32 @@ typedef struct
   char * szAnswer;
 } QuestionAnswerT;
 
-void setup_positions(PositionsT *, uint16_t, FILE *);
-static fpos_t (*get_next_position)(PositionsT *) = NULL;
-fpos_t get_random_position(PositionsT *);
-fpos_t get_sequential_position(PositionsT *);
+void setup_positions(PositionsT *, FILE *);
+static long (*get_next_position)(PositionsT *) = NULL;
+long get_random_position(PositionsT *);
+long get_sequential_position(PositionsT *);
 
-uint16_t QA_load(QuestionAnswerT *, PositionsT *, uint16_t, FILE *);
+uint16_t QA_load(QuestionAnswerT *, PositionsT *, uint16_t, sflash_reader *);
+void QA_free(QuestionAnswerT *, uint16_t);
 
-void prompt_loop(PositionsT *, FILE *);
+void prompt_loop(PositionsT *, sflash_reader *);
 typedef struct 
 {
   QuestionAnswerT * this_entry;
 } EntryProcessArgsT;
 typedef void (*fnEntryProcessT)(EntryProcessArgsT);
 fnEntryProcessT parse_answer(QuestionAnswerT *);
-
-typedef struct
-{
-  char ** list;
-  uint16_t len;
-} ListProcessorRetT;
-ListProcessorRetT process_list(char * restrict);
 void list_prompt(EntryProcessArgsT);
-
 void regular_prompt(EntryProcessArgsT);
-char ** tokenize_answer(char * restrict);
-float compare_words(char **, char **);
 
 static uint64_t ProgramOptions;
 static const uint64_t ProgramOptions_Randomize = 0x01;
 static const uint64_t ProgramOptions_Perpetual = 0x02;
-static uint64_t ProgramOptions_LongestLine = 1024;
 static uint32_t ProgramOptions_iMemoryChunk = 512;
 static uint16_t ProgramOptions_iMaxWordsInAnswer = 50;
 static uint16_t ProgramOptions_iMaxListItems = 50;
 static uint16_t ProgramOptions_iPairsToLoadAtOnce = 10;
+static const sflash_dialect * ProgramOptions_pDialect = NULL; //the default one
 
 int main(int argc, char ** argv)
 {
@@ -80,25 +67,28 @@ int main(int argc, char ** argv)
     {
       ProgramOptions |= ProgramOptions_Perpetual;
     }
-    else if(!strcmp(*pargv, "--set-max-line-characters"))
+    else if(!strcmp(*pargv, "--dialect"))
     {
-      if(!*++pargv)
+      if(!*++pargv
+        || !(ProgramOptions_pDialect = sflash_dialect_find(*pargv)))
       {
-        puts("Error: no integer given to "
-          "``--set-max-line-characters''");
+        puts("Error: ``--dialect'' takes default, qa, "
+          "semicolon or qa-semicolon");
         exit(1);
       }
-      ProgramOptions_LongestLine = atoi(*pargv);
     }
 
     ++pargv;
   }
 
   PositionsT pos;
-  setup_positions(&pos, ProgramOptions_iPairsToLoadAtOnce, file);
-  prompt_loop(&pos, file);
+  setup_positions(&pos, file);
+  sflash_reader * reader = sflash_reader_open(file, ProgramOptions_pDialect);
+  if(!reader) { puts("Out of memory"); exit(1); }
+  prompt_loop(&pos, reader);
 
-  free(pos.pQuestionPositions);
+  sflash_reader_close(reader);
+  sflash_offsets_free(pos.pQuestionPositions);
 
   fclose(file);
 
@@ -108,34 +98,36 @@ int main(int argc, char ** argv)
 void setup_positions
 (
   PositionsT * dest,
-  uint16_t iToSetUp,
   FILE * src
 )
 /*
+  Records where every question line starts, with the
+  dialect's scanning kernel in libsflash
+
   Up to the callee to free pQuestionPositions
 */
 {
+  sflash_error err;
   fseek(src, 0, SEEK_SET);
-  char * buf = malloc(ProgramOptions_iMemoryChunk);
-  char * pbuf = buf;
-  uint16_t iRead = 0;
-  char c = 0;
-  dest->iPositions = 0;
   dest->iCurrentPosition = 0;
-  dest->pQuestionPositions = malloc(iToSetUp * sizeof(fpos_t));
-  do
+  dest->pQuestionPositions = sflash_offsets_new();
+  if(!dest->pQuestionPositions)
   {
-    iRead = fread(buf, 1, ProgramOptions_iMemoryChunk, src);
-    for(uint16_t i = 0; i < iRead; ++i, ++pbuf)
-    {
-      if(*pbuf == DELIM_QUESTION)
-      {
-        dest->pQuestionPositions[dest->iPositions++] = ftell(src) + (pbuf - buf);
-      }
-    }
-    pbuf = buf;
-  } while(iRead == ProgramOptions_iMemoryChunk);
-  free(buf);
+    puts("Out of memory");
+    exit(1);
+  }
+  if(!sflash_deck_offsets(src, ProgramOptions_pDialect,
+    dest->pQuestionPositions, &err))
+  {
+    printf("Error: %s\n", err.message);
+    exit(1);
+  }
+
+  if(!sflash_offsets_count(dest->pQuestionPositions))
+  {
+    puts("No questions found");
+    exit(1);
+  }
 }
 
 uint16_t QA_load
@@ -143,192 +135,78 @@ uint16_t QA_load
   QuestionAnswerT * dest,
   PositionsT * src,
   uint16_t iToLoad, //Question/Answer pairs to load
-  FILE * file
+  sflash_reader * reader
 )
 /*
   `dest` must have `iToLoad` allocated,
-  empty QuestionAnswerT objects
+  empty QuestionAnswerT objects; each gets the
+  text after the markers
 
   Returns: pairs actually loaded
 */
 {
   uint16_t iLoaded = 0;
   QuestionAnswerT * pdest = dest;
-  char * szQuestion = malloc(ProgramOptions_LongestLine);
-  char * szAnswer = malloc(ProgramOptions_LongestLine);
+  sflash_card card;
+  sflash_error err;
   for(uint16_t i = 0; i < iToLoad; ++i)
   {
-    fseek(file, get_next_position(src), 0);
-r1:
-    fgets(szQuestion, ProgramOptions_LongestLine, file);
-    if(!strcmp(szQuestion, ""))
-      goto r1;
-r2:
-    fgets(szAnswer, ProgramOptions_LongestLine, file);
-    if(!strcmp(szAnswer, ""))
-      goto r2;
-    assert(szQuestion[0] == '-');
-    assert(szAnswer[0] == '+');
-    pdest->szQuestion = malloc(strlen(szQuestion) + 1);
-    memcpy(pdest->szQuestion, szQuestion, strlen(szQuestion) + 1);
-    pdest->szAnswer = malloc(strlen(szAnswer) + 1);
-    memcpy(pdest->szAnswer, szAnswer, strlen(szAnswer) + 1);
+    //edited cards may be indented, and leave '#' lines behind;
+    //the reader steps over both
+    sflash_reader_seek(reader, get_next_position(src), 0, 1);
+    int found = sflash_reader_next(reader, &card, &err);
+    if(found < 0)
+    {
+      printf("Error: %s\n", err.message);
+      exit(1);
+    }
+    if(!found)
+      break;
+    pdest->szQuestion = malloc(card.question_len + 1);
+    memcpy(pdest->szQuestion, card.question, card.question_len);
+    pdest->szQuestion[card.question_len] = 0;
+    pdest->szAnswer = malloc(card.answer_len + 1);
+    memcpy(pdest->szAnswer, card.answer, card.answer_len);
+    pdest->szAnswer[card.answer_len] = 0;
     ++pdest;
   }
-  free(szQuestion);
-  free(szAnswer);
 
   iLoaded = pdest - dest;
   return iLoaded;
 }
 
-fpos_t get_random_position
+void QA_free
 (
-  PositionsT * src
-)
-{
-  fpos_t ret = 0;
-  ret = rand() % src->iPositions;
-}
-
-char ** tokenize_answer
-(
-  char * restrict answer
+  QuestionAnswerT * qas,
+  uint16_t iLoaded
 )
 /*
-  Returns a null-terminated array
-
-  Callee must free the returned pointer, and
-  free its elements in a stepwise fashion
+  Frees the strings QA_load allocated, so each
+  batch reuses the same memory instead of growing
 */
 {
-  char * const buf = malloc(strlen(answer));
-  char * pbuf = buf;
-
-  char ** ret = malloc(ProgramOptions_iMaxWordsInAnswer);
-  uint16_t i = 0;
-
-  while(*answer != 0)
+  for(uint16_t i = 0; i < iLoaded; ++i)
   {
-    switch(*answer)
-    {
-      case ' ': case '-':
-      {
-        *pbuf = 0;
-        //TODO add word filter here
-        assert(i < ProgramOptions_iMaxWordsInAnswer);
-        ret[i] = malloc(pbuf - buf + 1);
-        memcpy(ret[i], buf, pbuf - buf + 1);
-        ++i;
-        pbuf = buf;
-
-        break;
-      }
-      case ',': case ';': case '.':
-        break;
-      default:
-      {
-        *(pbuf++) = *answer;
-        break;
-      }
-    }
+    free(qas[i].szQuestion);
+    free(qas[i].szAnswer);
+    qas[i].szQuestion = NULL;
+    qas[i].szAnswer = NULL;
   }
-  free(buf);
-
-  assert(i < ProgramOptions_iMaxWordsInAnswer);
-  ret[i] = NULL;
-  return ret;
 }
 
-float compare_words
+long get_random_position
 (
-  char ** restrict attempted,
-  char ** const correct
-)
-{
-  float ret = 0.0f;
-  uint16_t iMatchCount = 0;
-  uint16_t iWordCount = 0;
-
-  char ** pCorrect = correct;
-
-  while(*attempted != NULL)
-  {
-    while(*pCorrect != NULL)
-    {
-      if(!strcmp(*attempted, *pCorrect))
-      {
-        ++iMatchCount;
-      }
-      ++pCorrect;
-    }
-    pCorrect = correct;
-    ++attempted;
-    ++iWordCount;
-  }
-
-  assert(pCorrect - correct == iWordCount);
-  ret = iMatchCount / iWordCount;
-  return ret;
-}
-
-ListProcessorRetT process_list
-(
-  char * restrict src
+  PositionsT * src
 )
-/*
-  Returns a double pointer to memory that must be freed
-  in a stepwise fashion
-
-  The returned double pointer is null-terminated
-  at both levels
-*/
 {
-  uint8_t in_what = 0;
-  static const uint8_t in_entry = 0x01;
-
-  char * const buf = malloc(ProgramOptions_iMemoryChunk);
-  char * pbuf = buf;
-
-  char ** ret = malloc(ProgramOptions_iMaxListItems);
-  uint16_t i = 0;
-
-  for(; *src; ++src)
-  {
-    switch(*src)
-    {
-      case '{':
-        break;
-      case ',': case '}':
-      {
-        in_what -= in_entry;
-        *pbuf = 0;
-        assert(i < ProgramOptions_iMaxListItems);
-        ret[i] = malloc(pbuf - buf + 1);
-        memcpy(ret[i], buf, pbuf - buf + 1);
-        ++i;
-        pbuf = buf;
-      }
-      default:
-      {
-        in_what |= in_entry;
-        *(pbuf++) = *src;
-      }
-    }
-  }
-  
-  ret[i] = NULL;
-
-  ListProcessorRetT r1;
-  r1.list = ret;
-  r1.len = i;
-  return r1;
+  size_t iPositions = sflash_offsets_count(src->pQuestionPositions);
+  return sflash_offsets_get(src->pQuestionPositions, rand() % iPositions);
 }
 
 void prompt_loop
 (
   PositionsT * pos,
-  FILE * file
+  sflash_reader * reader
 )
 {
   QuestionAnswerT * const qas = malloc(ProgramOptions_iPairsToLoadAtOnce * sizeof(QuestionAnswerT));
@@ -338,14 +216,17 @@ void prompt_loop
 
   do
   {
-    iActuallyLoadedPairs = QA_load(qas, pos, ProgramOptions_iPairsToLoadAtOnce, file);
+    iActuallyLoadedPairs = QA_load(qas, pos, ProgramOptions_iPairsToLoadAtOnce, reader);
     for(uint16_t i = 0; i < iActuallyLoadedPairs; ++i)
     {
       fnPrompt = parse_answer(qas + i);
       args.this_entry = qas + i;
       fnPrompt(args);
     }
+    QA_free(qas, iActuallyLoadedPairs);
   } while(iActuallyLoadedPairs == ProgramOptions_iPairsToLoadAtOnce);
+
+  free(qas);
 }
 
 fnEntryProcessT parse_answer
@@ -353,25 +234,22 @@ fnEntryProcessT parse_answer
   QuestionAnswerT * qa
 )
 {
-  char * c = qa->szAnswer;
   fnEntryProcessT ret = NULL;
-  for(; *c; ++c)
+  const char * szAnswer = qa->szAnswer;
+  switch(sflash_answer_kind(szAnswer, strlen(szAnswer)))
   {
-    switch(*c)
+    case SFLASH_LIST:
     {
-      case '{':
-      {
-        ret = list_prompt;
-        goto end;
-      }
-      case ' ':
-        break;
-      default:
-      {
-        ret = regular_prompt;
-        goto end;
-      }
+      ret = list_prompt;
+      goto end;
+    }
+    case SFLASH_TOKENS: case SFLASH_SEQUENCE:
+    {
+      ret = regular_prompt;
+      goto end;
     }
+    default:
+      break;
   }
   //TODO make this a longjmp
   puts("Fatal parsing error");
@@ -387,32 +265,31 @@ void list_prompt
 {
   char * buf = malloc(ProgramOptions_iMemoryChunk);
   printf("Q: %s\n> [list input]\n", src.this_entry->szQuestion);
-  ListProcessorRetT result = process_list(src.this_entry->szAnswer);
-  char ** plist = result.list;
-  for(uint16_t i = 0; i < result.len; ++i)
+  const char * szAnswer = src.this_entry->szAnswer;
+  size_t iAnswerLen = strlen(szAnswer);
+  char * items = malloc(iAnswerLen + 1);
+  sflash_span list[ProgramOptions_iMaxListItems];
+  size_t iItems = sflash_split(ProgramOptions_pDialect, SFLASH_LIST,
+    szAnswer, iAnswerLen, items, list, ProgramOptions_iMaxListItems);
+  if(iItems > ProgramOptions_iMaxListItems)
+    iItems = ProgramOptions_iMaxListItems;
+  for(uint16_t i = 0; i < iItems; ++i)
   {
 attempt:
     puts("  -> ");
-    gets(buf);
-    for(plist = result.list; *plist != NULL; ++plist)
+    if(!fgets(buf, ProgramOptions_iMemoryChunk, stdin))
+      break;
+    buf[strcspn(buf, "\n")] = 0;
+    if(sflash_find_item(list, iItems, buf, strlen(buf)) >= 0)
     {
-      if(!strcmp(buf, *plist))
-      {
-        puts("Correct!");
-        goto keep_going;
-      }
+      puts("Correct!");
+      continue;
     }
     puts("No list item found. Try again.");
     goto attempt;
-keep_going:
-    ;
   }
+  free(items);
   free(buf);
-  for(char ** plist = result.list; plist != NULL; ++plist)
-  {
-    free(*plist);
-  }
-  free(plist);
 }
 
 void regular_prompt
@@ -422,26 +299,31 @@ void regular_prompt
 {
   char * buf = malloc(ProgramOptions_iMemoryChunk);
   printf("Q: %s\n> ", src.this_entry->szQuestion);
-  char ** RealAnswerTokens = tokenize_answer(src.this_entry->szAnswer);
-  char ** GivenAnswerTokens = NULL;
-  float fResults = 0.0f;
-
-  gets(buf);
-  GivenAnswerTokens = tokenize_answer(buf);
-  fResults = compare_words(GivenAnswerTokens, RealAnswerTokens);
-  printf("Ratio correct: %2f.\n", fResults);
-
-  for(char ** p = RealAnswerTokens; *p != NULL; ++p)
+  const char * szAnswer = src.this_entry->szAnswer;
+  size_t iAnswerLen = strlen(szAnswer);
+  char * real = malloc(iAnswerLen + 1);
+  sflash_span RealAnswerTokens[ProgramOptions_iMaxWordsInAnswer];
+  size_t iReal = sflash_split(ProgramOptions_pDialect, SFLASH_TOKENS,
+    szAnswer, iAnswerLen, real, RealAnswerTokens, ProgramOptions_iMaxWordsInAnswer);
+  char * given = malloc(ProgramOptions_iMemoryChunk);
+  sflash_span GivenAnswerTokens[ProgramOptions_iMaxWordsInAnswer];
+  size_t iGiven = 0;
+  sflash_grade grade;
+
+  if(fgets(buf, ProgramOptions_iMemoryChunk, stdin))
   {
-    free(*p);
+    iGiven = sflash_split_input(ProgramOptions_pDialect, SFLASH_TOKENS,
+      buf, strlen(buf), given, GivenAnswerTokens, ProgramOptions_iMaxWordsInAnswer);
   }
-  free(RealAnswerTokens);
-
-  for(char ** p = GivenAnswerTokens; *p != NULL; ++p)
-  {
-    free(*p);
-  }
-  free(GivenAnswerTokens);
-
+  if(iReal > ProgramOptions_iMaxWordsInAnswer)
+    iReal = ProgramOptions_iMaxWordsInAnswer;
+  if(iGiven > ProgramOptions_iMaxWordsInAnswer)
+    iGiven = ProgramOptions_iMaxWordsInAnswer;
+  sflash_grade_words(RealAnswerTokens, NULL, iReal,
+    GivenAnswerTokens, iGiven, &grade);
+  printf("Ratio correct: %2f.\n", sflash_grade_score(&grade));
+
+  free(real);
+  free(given);
   free(buf);
 }
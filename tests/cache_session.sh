@@ -0,0 +1,32 @@
+#!/bin/sh
+# Runs the same perpetual session with the card cache on and off
+# and fails when the cards shown differ.
+#
+#   tests/cache_session.sh path/to/sflash2
+
+SFLASH2=${1:-./sflash2}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+i=0
+while [ $i -lt 7 ]; do
+  printf -- '-q%d\n+a%d\n' $i $i >> "$DIR/tight.txt"
+  printf -- '-q%d\n+a%d\n\n' $i $i >> "$DIR/spaced.txt"
+  i=$((i + 1))
+done
+
+status=0
+for deck in tight spaced; do
+  for mb in 0 64; do
+    yes "" | timeout 5 "$SFLASH2" "$DIR/$deck.txt" -p -t 0 --cache-mb $mb \
+      2>&1 | head -n 300 > "$DIR/$deck.$mb"
+  done
+  if ! cmp -s "$DIR/$deck.0" "$DIR/$deck.64"; then
+    echo "FAIL: $deck deck differs with the cache on"
+    diff "$DIR/$deck.0" "$DIR/$deck.64" | head -n 20
+    status=1
+  else
+    echo "ok: $deck deck"
+  fi
+done
+exit $status